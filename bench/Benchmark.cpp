@@ -0,0 +1,269 @@
+// Throughput benchmarks of the processors and Image operators on
+// synthetic images. Build the bench target in a release configuration:
+//   cmake -DCMAKE_BUILD_TYPE=Release .. && cmake --build . --target bench
+//   ./bench [--sizes 256,2K,8K,odd] [--filter text] [--reps N] [--warmup N]
+//           [--threads N] [--json results.json]
+#include "Image.h"
+#include "SobelFilter.h"
+#include "BrightnessContrast.h"
+#include "GammaCorrection.h"
+#include "PointOp.h"
+#include "MeanBlur.h"
+#include "GaussianBlur.h"
+#include "RecursiveGaussianBlur.h"
+#include "Convolution.h"
+#include "IntegralImage.h"
+#include "Pipeline.h"
+#include "SimdArithmetic.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Size2D {
+    const char* name;
+    unsigned int width;
+    unsigned int height;
+};
+
+// Square sizes from cache-resident to far past the last level cache, and
+// widths that are not a multiple of any vector width
+const std::vector<Size2D> kSizes = {
+    {"256", 256, 256},
+    {"2K", 2048, 2048},
+    {"8K", 8192, 8192},
+    {"odd", 1023, 769},
+    {"odd-wide", 4097, 515},
+};
+
+struct Options {
+    std::vector<std::string> sizes;
+    std::string filter;
+    unsigned int reps = 7;
+    unsigned int warmup = 2;
+    unsigned int threads = 0;
+    std::string jsonPath;
+};
+
+// One thing to time: run() is called on prepared images, bytesPerPixel is
+// the minimum traffic per output pixel (every input read once, the output
+// written once)
+struct Case {
+    std::string name;
+    double bytesPerPixel;
+    std::function<void()> run;
+};
+
+struct Result {
+    std::string name;
+    const Size2D* size;
+    double medianMs;
+    double minMs;
+    double bytesPerPixel;
+};
+
+// Smooth gradient plus xorshift noise, the same for every run
+Image syntheticImage(unsigned int width, unsigned int height, uint32_t seed) {
+    Image image(width, height);
+    uint32_t state = seed;
+    for (unsigned int y = 0; y < height; y++) {
+        unsigned char* row = image.row(y);
+        for (unsigned int x = 0; x < width; x++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            int value = static_cast<int>((x + y) * 255 / (width + height)) + static_cast<int>(state % 64) - 32;
+            row[x] = static_cast<unsigned char>(std::min(255, std::max(0, value)));
+        }
+    }
+    return image;
+}
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    size_t middle = values.size() / 2;
+    return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2.0;
+}
+
+Result measure(const Case& benchmark, const Size2D& size, const Options& options) {
+    for (unsigned int i = 0; i < options.warmup; i++) {
+        benchmark.run();
+    }
+    std::vector<double> times;
+    for (unsigned int i = 0; i < options.reps; i++) {
+        auto start = std::chrono::steady_clock::now();
+        benchmark.run();
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return Result{benchmark.name, &size, median(times), *std::min_element(times.begin(), times.end()),
+                  benchmark.bytesPerPixel};
+}
+
+double megapixelsPerSecond(const Result& result, double ms) {
+    return static_cast<double>(result.size->width) * result.size->height / 1000.0 / ms;
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+void writeJson(const std::string& path, const std::vector<Result>& results, const Options& options) {
+    std::ofstream out(path);
+    out << "{\n  \"isa\": \"" << SimdArithmetic::best().name << "\",\n"
+        << "  \"threads\": " << ThreadPool::instance().threadCount() << ",\n"
+        << "  \"warmup\": " << options.warmup << ",\n"
+        << "  \"reps\": " << options.reps << ",\n"
+        << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << "    {\"name\": \"" << jsonEscape(r.name) << "\", \"size\": \"" << r.size->name << "\""
+            << ", \"width\": " << r.size->width << ", \"height\": " << r.size->height
+            << ", \"median_ms\": " << r.medianMs << ", \"min_ms\": " << r.minMs
+            << ", \"mpix_per_s\": " << megapixelsPerSecond(r, r.medianMs)
+            << ", \"mpix_per_s_best\": " << megapixelsPerSecond(r, r.minMs)
+            << ", \"bytes_per_pixel\": " << r.bytesPerPixel
+            << ", \"gb_per_s\": " << megapixelsPerSecond(r, r.medianMs) * r.bytesPerPixel / 1000.0 << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    if (!out)
+        std::cerr << "Error writing " << path << std::endl;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const std::string argument = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        const std::string value = argv[++i];
+        if (argument == "--sizes") {
+            std::istringstream list(value);
+            std::string size;
+            while (std::getline(list, size, ','))
+                options.sizes.push_back(size);
+        } else if (argument == "--filter") {
+            options.filter = value;
+        } else if (argument == "--reps") {
+            options.reps = std::max(1, std::stoi(value));
+        } else if (argument == "--warmup") {
+            options.warmup = static_cast<unsigned int>(std::max(0, std::stoi(value)));
+        } else if (argument == "--threads") {
+            options.threads = static_cast<unsigned int>(std::max(0, std::stoi(value)));
+        } else if (argument == "--json") {
+            options.jsonPath = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--sizes 256,2K,8K,odd,odd-wide] [--filter text] [--reps N] [--warmup N]"
+                     " [--threads N] [--json path]" << std::endl;
+        return 1;
+    }
+    if (options.threads)
+        ThreadPool::instance().setThreadCount(options.threads);
+
+    SobelFilter sobelL2(SobelFilter::Norm::L2), sobelL1(SobelFilter::Norm::L1), sobelMax(SobelFilter::Norm::Max);
+    BrightnessContrast brightnessContrast(1.5f, 30.0f);
+    GammaCorrection gamma(0.5f);
+    PointOp fusedPointOps = gamma.then(brightnessContrast).then(PointOp::add(20));
+    MeanBlur mean5(5), mean15(15);
+    GaussianBlur gaussian5(5, 1.0f), gaussian15(15, 3.0f);
+    RecursiveGaussianBlur recursive(4.0f);
+    Convolution sharpen({{0, -1, 0}, {-1, 5, -1}, {0, -1, 0}});
+    Convolution box5(std::vector<std::vector<float>>(5, std::vector<float>(5, 1.0f / 25)));
+    Convolution binomial7(FixedKernels::kGaussian7);
+    Convolution box31(std::vector<std::vector<float>>(31, std::vector<float>(31, 1.0f / 961)));
+    Convolution box127(std::vector<std::vector<float>>(127, std::vector<float>(127, 1.0f / 16129)));
+    Pipeline blurEdges{&gaussian5, &sobelL2};
+
+    const std::vector<std::pair<const char*, ImageProcessing*>> processors = {
+        {"sobel-l2", &sobelL2}, {"sobel-l1", &sobelL1}, {"sobel-max", &sobelMax},
+        {"brightness-contrast", &brightnessContrast}, {"gamma", &gamma}, {"point-ops-fused", &fusedPointOps},
+        {"mean-5", &mean5}, {"mean-15", &mean15}, {"gaussian-5", &gaussian5}, {"gaussian-15", &gaussian15},
+        {"recursive-gaussian-4", &recursive}, {"convolution-3x3", &sharpen}, {"convolution-5x5", &box5},
+        {"convolution-7x7-binomial", &binomial7},
+        {"convolution-31x31-fft", &box31}, {"convolution-127x127-fft", &box127},
+        {"pipeline-gaussian-sobel", &blurEdges},
+    };
+
+    std::cout << "isa " << SimdArithmetic::best().name << ", " << ThreadPool::instance().threadCount()
+              << " threads, " << options.warmup << " warmup + " << options.reps << " reps" << std::endl;
+    std::cout << std::left << std::setw(26) << "benchmark" << std::setw(10) << "size" << std::right
+              << std::setw(12) << "median ms" << std::setw(12) << "min ms" << std::setw(12) << "MP/s"
+              << std::setw(12) << "best MP/s" << std::setw(8) << "B/px" << std::setw(10) << "GB/s" << std::endl;
+
+    std::vector<Result> results;
+    for (const Size2D& size : kSizes) {
+        if (!options.sizes.empty() &&
+            std::find(options.sizes.begin(), options.sizes.end(), size.name) == options.sizes.end())
+            continue;
+
+        Image a = syntheticImage(size.width, size.height, 1);
+        Image b = syntheticImage(size.width, size.height, 2);
+        Image c = syntheticImage(size.width, size.height, 3);
+        Image output(size.width, size.height);
+        IntegralImage integral;
+
+        std::vector<Case> cases;
+        for (const auto& processor : processors) {
+            ImageProcessing* p = processor.second;
+            cases.push_back({processor.first, 2.0, [p, &a, &output] { p->process(a, output); }});
+        }
+        cases.push_back({"image-add", 3.0, [&] { output = a + b; }});
+        cases.push_back({"image-subtract", 3.0, [&] { output = a - b; }});
+        cases.push_back({"image-multiply", 3.0, [&] { output = a * b; }});
+        cases.push_back({"image-add-scalar", 2.0, [&] { output = a + static_cast<unsigned char>(40); }});
+        cases.push_back({"image-multiply-scalar", 2.0, [&] { output = a * 0.75f; }});
+        cases.push_back({"image-expression-fused", 4.0, [&] { output = (a + b) * c - static_cast<unsigned char>(10); }});
+        // One read of the image per table, then a write and, in the column
+        // sweep, a read and a write of every table entry
+        const uint64_t pixels = static_cast<uint64_t>(size.width) * size.height;
+        const double sumBytes = pixels * 255 <= UINT32_MAX ? 4.0 : 8.0;
+        const double squareBytes = pixels * 255 * 255 <= UINT32_MAX ? 4.0 : 8.0;
+        cases.push_back({"integral-image", 2.0 + 3.0 * (sumBytes + squareBytes), [&] { integral.compute(a); }});
+
+        for (const Case& benchmark : cases) {
+            if (!options.filter.empty() && benchmark.name.find(options.filter) == std::string::npos)
+                continue;
+            Result result = measure(benchmark, size, options);
+            results.push_back(result);
+            std::cout << std::left << std::setw(26) << result.name << std::setw(10) << size.name << std::right
+                      << std::fixed << std::setprecision(3) << std::setw(12) << result.medianMs
+                      << std::setw(12) << result.minMs << std::setprecision(1)
+                      << std::setw(12) << megapixelsPerSecond(result, result.medianMs)
+                      << std::setw(12) << megapixelsPerSecond(result, result.minMs)
+                      << std::setw(8) << result.bytesPerPixel << std::setprecision(2)
+                      << std::setw(10) << megapixelsPerSecond(result, result.medianMs) * result.bytesPerPixel / 1000.0
+                      << std::defaultfloat << std::endl;
+        }
+    }
+
+    if (!options.jsonPath.empty())
+        writeJson(options.jsonPath, results, options);
+    return 0;
+}
@@ -0,0 +1,313 @@
+#include "Batch.h"
+#include "BoundedQueue.h"
+#include "BrightnessContrast.h"
+#include "Convolution.h"
+#include "GammaCorrection.h"
+#include "GaussianBlur.h"
+#include "MeanBlur.h"
+#include "RecursiveGaussianBlur.h"
+#include "SobelFilter.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    std::istringstream in(text);
+    std::string part;
+    while (std::getline(in, part, separator)) {
+        parts.push_back(part);
+    }
+    return parts;
+}
+
+float number(const std::vector<std::string>& fields, size_t index) {
+    size_t used = 0;
+    float value = std::stof(fields[index], &used);
+    if (used != fields[index].size())
+        throw std::invalid_argument("Bad number in operation " + fields[0] + ": " + fields[index]);
+    return value;
+}
+
+std::unique_ptr<ImageProcessing> makeStage(const std::vector<std::string>& fields) {
+    const std::string& name = fields[0];
+    const size_t arguments = fields.size() - 1;
+    auto expect = [&](size_t count) {
+        if (arguments != count)
+            throw std::invalid_argument("Operation " + name + " takes " + std::to_string(count) + " argument(s)");
+    };
+
+    if (name == "sobel") {
+        if (arguments > 1)
+            throw std::invalid_argument("Operation sobel takes at most 1 argument");
+        const std::string norm = arguments ? fields[1] : "l2";
+        if (norm == "l2") return std::make_unique<SobelFilter>(SobelFilter::Norm::L2);
+        if (norm == "l1") return std::make_unique<SobelFilter>(SobelFilter::Norm::L1);
+        if (norm == "max") return std::make_unique<SobelFilter>(SobelFilter::Norm::Max);
+        throw std::invalid_argument("Unknown Sobel norm: " + norm);
+    }
+    if (name == "gamma") {
+        expect(1);
+        return std::make_unique<GammaCorrection>(number(fields, 1));
+    }
+    if (name == "bc") {
+        expect(2);
+        return std::make_unique<BrightnessContrast>(number(fields, 1), number(fields, 2));
+    }
+    if (name == "mean") {
+        expect(1);
+        return std::make_unique<MeanBlur>(static_cast<int>(number(fields, 1)));
+    }
+    if (name == "gaussian") {
+        expect(2);
+        return std::make_unique<GaussianBlur>(static_cast<int>(number(fields, 1)), number(fields, 2));
+    }
+    if (name == "recursive") {
+        expect(1);
+        return std::make_unique<RecursiveGaussianBlur>(number(fields, 1));
+    }
+    if (name == "sharpen") {
+        expect(0);
+        return std::make_unique<Convolution>(std::vector<std::vector<float>>{{0, -1, 0}, {-1, 5, -1}, {0, -1, 0}});
+    }
+    throw std::invalid_argument("Unknown operation: " + name);
+}
+
+// Shell-style match of * and ? against a whole file name
+bool matches(const char* pattern, const char* name) {
+    if (*pattern == '\0')
+        return *name == '\0';
+    if (*pattern == '*')
+        return matches(pattern + 1, name) || (*name != '\0' && matches(pattern, name + 1));
+    return *name != '\0' && (*pattern == '?' || *pattern == *name) && matches(pattern + 1, name + 1);
+}
+
+std::vector<std::string> directoryEntries(const fs::path& directory, const std::string& pattern) {
+    std::vector<std::string> files;
+    std::error_code error;
+    for (const fs::directory_entry& entry : fs::directory_iterator(directory, error)) {
+        const std::string name = entry.path().filename().string();
+        if (entry.is_regular_file(error) && matches(pattern.c_str(), name.c_str()))
+            files.push_back(entry.path().string());
+    }
+    if (error)
+        std::cerr << "Error listing directory: " << directory.string() << std::endl;
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// An image on its way from the reader to the writer, with its timings
+struct BatchItem {
+    std::string path;
+    std::string target;
+    Image image;
+    bool ok = false;
+    double readMs = 0.0;
+    double processMs = 0.0;
+};
+
+} // namespace
+
+ProcessorChain::ProcessorChain(const std::string& spec) {
+    for (const std::string& operation : split(spec, ',')) {
+        if (operation.empty())
+            continue;
+        m_stages.push_back(makeStage(split(operation, ':')));
+        m_pipeline.add(*m_stages.back());
+    }
+}
+
+ImageProcessing& ProcessorChain::processor() {
+    return m_pipeline;
+}
+
+std::vector<std::string> collectInputs(const std::vector<std::string>& inputs) {
+    std::vector<std::string> files;
+    for (const std::string& input : inputs) {
+        std::error_code error;
+        if (!input.empty() && input[0] == '@') {
+            std::ifstream list(input.substr(1));
+            if (!list)
+                std::cerr << "Error opening file list: " << input.substr(1) << std::endl;
+            std::string line;
+            while (std::getline(list, line)) {
+                if (!line.empty())
+                    files.push_back(line);
+            }
+        } else if (fs::is_directory(input, error)) {
+            std::vector<std::string> found = directoryEntries(input, "*.pgm");
+            files.insert(files.end(), found.begin(), found.end());
+        } else if (input.find_first_of("*?") != std::string::npos) {
+            fs::path path(input);
+            fs::path directory = path.has_parent_path() ? path.parent_path() : fs::path(".");
+            std::vector<std::string> found = directoryEntries(directory, path.filename().string());
+            files.insert(files.end(), found.begin(), found.end());
+        } else {
+            files.push_back(input);
+        }
+    }
+    return files;
+}
+
+// Items keep their order through the reader and the writer but not through
+// the workers, so the per-file lines come out in completion order. An
+// exception reading, processing or writing a file fails that file only;
+// one escaping a thread body would end the program.
+unsigned int runBatch(const BatchOptions& options) {
+    const std::vector<std::string> files = collectInputs(options.inputs);
+
+    // Outputs keep only the file name, so inputs from different
+    // directories can clash; refuse the run before anything is written
+    std::vector<std::string> targets;
+    std::map<std::string, std::string> sources;
+    for (const std::string& path : files) {
+        targets.push_back((fs::path(options.outputDir) / fs::path(path).filename()).string());
+        auto inserted = sources.emplace(targets.back(), path);
+        if (!inserted.second)
+            throw std::invalid_argument("Inputs " + inserted.first->second + " and " + path +
+                                        " would both be written to " + targets.back());
+    }
+
+    // Every worker gets its own chain, since not every processor can run
+    // on two images at once. They are built before the output directory is
+    // created, so a malformed specification leaves nothing behind
+    const unsigned int workers = options.workers ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::unique_ptr<ProcessorChain>> chains;
+    for (unsigned int i = 0; i < workers; i++) {
+        chains.push_back(std::make_unique<ProcessorChain>(options.operations));
+    }
+
+    std::error_code error;
+    fs::create_directories(options.outputDir, error);
+    if (error) {
+        std::cerr << "Error creating output directory: " << options.outputDir << std::endl;
+        return static_cast<unsigned int>(files.size());
+    }
+
+    ThreadPool& pool = ThreadPool::instance();
+    const unsigned int poolThreads = pool.threadCount();
+    if (workers > 1)
+        pool.setThreadCount(1); // the workers already keep the cores busy
+
+    BoundedQueue<BatchItem> toProcess(options.queueDepth);
+    BoundedQueue<BatchItem> toWrite(options.queueDepth);
+    const Clock::time_point start = Clock::now();
+
+    std::thread reader([&] {
+        for (size_t i = 0; i < files.size(); i++) {
+            const std::string& path = files[i];
+            BatchItem item;
+            item.path = path;
+            item.target = targets[i];
+            Clock::time_point readStart = Clock::now();
+            try {
+                item.ok = item.image.load(path);
+            } catch (const std::exception& e) {
+                std::cerr << "Error reading " << path << ": " << e.what() << std::endl;
+                item.image.release();
+                item.ok = false;
+            }
+            item.readMs = millisecondsSince(readStart);
+            toProcess.push(std::move(item));
+        }
+        toProcess.close();
+    });
+
+    std::vector<std::thread> computeThreads;
+    for (unsigned int i = 0; i < workers; i++) {
+        computeThreads.emplace_back([&, i] {
+            ImageProcessing& processor = chains[i]->processor();
+            BatchItem item;
+            Image output;
+            while (toProcess.pop(item)) {
+                if (item.ok) {
+                    Clock::time_point processStart = Clock::now();
+                    try {
+                        item.ok = processor.process(item.image, output);
+                    } catch (const std::exception& e) {
+                        std::cerr << "Error processing " << item.path << ": " << e.what() << std::endl;
+                        item.ok = false;
+                    }
+                    item.processMs = millisecondsSince(processStart);
+                    std::swap(item.image, output);
+                }
+                toWrite.push(std::move(item));
+            }
+        });
+    }
+
+    unsigned int failed = 0;
+    unsigned long long pixels = 0;
+    double readMs = 0.0, processMs = 0.0, writeMs = 0.0;
+    std::thread writer([&] {
+        BatchItem item;
+        while (toWrite.pop(item)) {
+            double itemWriteMs = 0.0;
+            if (item.ok) {
+                Clock::time_point writeStart = Clock::now();
+                try {
+                    item.ok = item.image.save(item.target);
+                } catch (const std::exception& e) {
+                    std::cerr << "Error writing " << item.target << ": " << e.what() << std::endl;
+                    item.ok = false;
+                }
+                itemWriteMs = millisecondsSince(writeStart);
+            }
+
+            std::ostringstream line;
+            line << std::fixed << std::setprecision(1) << item.path;
+            if (item.ok) {
+                const double megapixels = static_cast<double>(item.image.width()) * item.image.height() / 1e6;
+                const double totalMs = item.readMs + item.processMs + itemWriteMs;
+                line << "  " << item.image.width() << "x" << item.image.height()
+                     << "  read " << item.readMs << " ms  process " << item.processMs
+                     << " ms  write " << itemWriteMs << " ms  "
+                     << (totalMs > 0.0 ? megapixels * 1000.0 / totalMs : 0.0) << " MP/s";
+                pixels += static_cast<unsigned long long>(item.image.width()) * item.image.height();
+                readMs += item.readMs;
+                processMs += item.processMs;
+                writeMs += itemWriteMs;
+            } else {
+                line << "  FAILED";
+                failed++;
+            }
+            std::cout << line.str() << std::endl;
+        }
+    });
+
+    reader.join();
+    for (std::thread& thread : computeThreads) {
+        thread.join();
+    }
+    toWrite.close();
+    writer.join();
+    pool.setThreadCount(poolThreads);
+
+    const double wallMs = millisecondsSince(start);
+    std::cout << std::fixed << std::setprecision(1)
+              << files.size() - failed << " of " << files.size() << " files in " << wallMs << " ms, "
+              << (wallMs > 0.0 ? files.size() * 1000.0 / wallMs : 0.0) << " files/s, "
+              << (wallMs > 0.0 ? pixels / 1000.0 / wallMs : 0.0) << " MP/s, " << workers << " worker(s)"
+              << " (busy time: read " << readMs << " ms, process " << processMs << " ms, write " << writeMs << " ms)"
+              << std::defaultfloat << std::endl;
+    return failed;
+}
@@ -0,0 +1,78 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "ImageProcessing.h"
+#include "Pipeline.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Chain of processors built from a text specification
+ *
+ * The specification is a comma-separated list of operations, each a name
+ * followed by colon-separated arguments:
+ *   sobel[:l2|l1|max], gamma:G, bc:FACTOR:BIAS, mean:SIZE,
+ *   gaussian:SIZE:SIGMA, recursive:SIGMA, sharpen
+ * for example "gaussian:5:1.0,sobel:l1". The stages run tile-fused through
+ * a Pipeline; an empty specification copies the image.
+ */
+class ProcessorChain {
+public:
+    /**
+     * @brief Constructor
+     * @param spec Operation specification
+     * @throws std::invalid_argument if the specification is malformed
+     */
+    explicit ProcessorChain(const std::string& spec);
+
+    /**
+     * @brief Processor running the whole chain
+     */
+    ImageProcessing& processor();
+
+private:
+    std::vector<std::unique_ptr<ImageProcessing>> m_stages;
+    Pipeline m_pipeline;
+};
+
+/**
+ * @brief Settings of a batch run
+ */
+struct BatchOptions {
+    std::vector<std::string> inputs; // files, directories, glob patterns or @list files
+    std::string outputDir;           // created if missing; outputs keep the input file names
+    std::string operations;          // ProcessorChain specification
+    unsigned int workers = 0;        // compute threads, 0 for the hardware thread count
+    unsigned int queueDepth = 8;     // images buffered between the stages
+};
+
+/**
+ * @brief Expand input specifications to a list of files
+ * A directory gives its .pgm files, a path whose file name contains * or ?
+ * the matching files of its directory, @path the lines of a list file, and
+ * anything else itself. Directory and pattern matches are sorted.
+ * @param inputs Input specifications
+ * @return File paths, in the order of the specifications
+ */
+std::vector<std::string> collectInputs(const std::vector<std::string>& inputs);
+
+/**
+ * @brief Process many files with reading, processing and writing overlapped
+ *
+ * One thread reads, options.workers threads process and one thread
+ * writes; bounded queues between them keep disk I/O running while images
+ * are processed, with at most a few queue depths of images in memory.
+ * With several workers each image is processed on its worker alone, with
+ * one worker the image is split over the ThreadPool. A line per file and
+ * an aggregate throughput line are printed; a file that cannot be read,
+ * processed or written is reported as FAILED and the run goes on.
+ * @param options Batch settings
+ * @return Number of files that failed
+ * @throws std::invalid_argument if the operation specification is malformed,
+ *         or if two inputs have the same file name and would overwrite
+ *         each other in the output directory
+ */
+unsigned int runBatch(const BatchOptions& options);
+
+#endif // BATCH_H
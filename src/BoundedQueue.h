@@ -0,0 +1,80 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Blocking FIFO of bounded capacity between producer and consumer threads
+ *
+ * push waits while the queue is full, so a fast producer cannot run ahead
+ * of its consumers by more than the capacity; pop waits while it is empty.
+ * After close() the remaining items can still be popped, then pop returns
+ * false. The items live in a ring allocated once, so passing items through
+ * the queue never allocates.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Maximum number of queued items, at least 1
+     */
+    explicit BoundedQueue(size_t capacity)
+        : m_items(capacity > 0 ? capacity : 1), m_head(0), m_count(0), m_closed(false) {}
+
+    /**
+     * @brief Append an item, waiting for room
+     * @return false if the queue was closed, the item is then dropped
+     */
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [&] { return m_closed || m_count < m_items.size(); });
+        if (m_closed)
+            return false;
+        m_items[(m_head + m_count) % m_items.size()] = std::move(item);
+        m_count++;
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Take the oldest item, waiting for one
+     * @return false once the queue is closed and empty
+     */
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [&] { return m_closed || m_count > 0; });
+        if (m_count == 0)
+            return false;
+        item = std::move(m_items[m_head]);
+        m_head = (m_head + 1) % m_items.size();
+        m_count--;
+        m_notFull.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Refuse further items and wake all waiting threads
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+private:
+    std::vector<T> m_items; // ring of m_count items starting at m_head
+    size_t m_head;
+    size_t m_count;
+    bool m_closed;
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+};
+
+#endif // BOUNDED_QUEUE_H
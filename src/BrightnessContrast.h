@@ -1,9 +1,12 @@
 #ifndef BRIGHTNESS_CONTRAST_H
 #define BRIGHTNESS_CONTRAST_H
 
-#include "ImageProcessing.h"
+#include "PointOp.h"
 
-class BrightnessContrast : public ImageProcessing {
+/**
+ * @brief Brightness and contrast adjustment, a PointOp so it can be fused with other point operations
+ */
+class BrightnessContrast : public PointOp {
 public:
     /**
      * @brief Constructor for brightness and contrast adjustment
@@ -12,13 +15,6 @@ public:
      */
     BrightnessContrast(float factor, float bias);
 
-    /**
-     * @brief Process the image to adjust brightness and contrast
-     * @param input Source image
-     * @param output Destination image
-     */
-    bool process(const Image& input, Image& output) override;
-
     ~BrightnessContrast();
 
 private:
@@ -1,55 +1,310 @@
 #include "Convolution.h"
+#include "Fft.h"
+#include "ThreadPool.h"
 #include <cmath>
 #include <algorithm>
 #include <stdexcept>
+#include <vector>
 
-Convolution::Convolution(const std::vector<std::vector<float>>& kernel)
-    : m_kernel(kernel) {
-    if (kernel.empty() || kernel.size() != kernel[0].size() || kernel.size() % 2 == 0)
+namespace {
+
+// Largest FFT side picked for a kernel that fits it: 512 x 512 floats plus
+// the spectrum is 2 MB of scratch per thread
+const unsigned int kMaxFftSize = 512;
+
+// The FFT side with about the least work per output pixel: a tile of side
+// n yields n - kernelSize + 1 output rows and columns for about
+// n^2 log2(n) operations. A larger side has to save more than a tenth to be
+// picked, as its tiles fit the caches less well and waste more past the
+// image edges.
+unsigned int fftSizeFor(int kernelSize) {
+    unsigned int best = 4;
+    while (best < static_cast<unsigned int>(kernelSize)) best *= 2;
+    double bestCost = 1e300;
+    for (unsigned int size = best; size <= std::max(best, kMaxFftSize); size *= 2) {
+        double tile = size - kernelSize + 1.0;
+        double cost = static_cast<double>(size) * size * std::log2(static_cast<double>(size)) / (tile * tile);
+        if (cost < 0.9 * bestCost) {
+            bestCost = cost;
+            best = size;
+        }
+    }
+    return best;
+}
+
+struct KnownKernel {
+    int size;
+    const float* taps;
+    FixedRowFunction row;
+};
+
+template <int N, const FixedKernel<N>& K>
+KnownKernel known() {
+    return KnownKernel{N, K.taps, &constantKernelRow<N, K>};
+}
+
+// Kernels that get a row function of their own, with their zero taps dropped
+const KnownKernel kKnownKernels[] = {
+    known<3, FixedKernels::kSobelX>(),    known<3, FixedKernels::kSobelY>(),    known<3, FixedKernels::kLaplacian>(),
+    known<3, FixedKernels::kSharpen>(),   known<3, FixedKernels::kBox3>(),      known<5, FixedKernels::kBox5>(),
+    known<7, FixedKernels::kBox7>(),      known<3, FixedKernels::kGaussian3>(), known<5, FixedKernels::kGaussian5>(),
+    known<7, FixedKernels::kGaussian7>(),
+};
+
+// The constant-kernel row function when the taps are those of a known
+// kernel, the unrolled one of the kernel's size otherwise, nullptr for
+// sizes without one
+FixedRowFunction rowFunctionFor(const std::vector<float>& taps, int size) {
+    for (const KnownKernel& kernel : kKnownKernels) {
+        if (kernel.size == size && std::equal(taps.begin(), taps.end(), kernel.taps))
+            return kernel.row;
+    }
+    switch (size) {
+    case 3: return &fixedKernelRow<3>;
+    case 5: return &fixedKernelRow<5>;
+    case 7: return &fixedKernelRow<7>;
+    default: return nullptr;
+    }
+}
+
+} // namespace
+
+Convolution::Convolution(const std::vector<std::vector<float>>& kernel, Border border)
+    : m_kernel(kernel), m_border(border), m_method(Method::Automatic) {
+    if (kernel.empty() || kernel.size() % 2 == 0)
         throw std::invalid_argument("Kernel must be a square matrix with odd dimensions");
+    for (const std::vector<float>& row : kernel) {
+        if (row.size() != kernel.size())
+            throw std::invalid_argument("Kernel must be a square matrix with odd dimensions");
+    }
     m_kernelSize = kernel.size();
+    for (const std::vector<float>& row : kernel) {
+        m_taps.insert(m_taps.end(), row.begin(), row.end());
+    }
+    m_rowFunction = rowFunctionFor(m_taps, m_kernelSize);
+    if (usesFft())
+        prepareFft();
 }
 
-bool Convolution::process(const Image& src, Image& dst) {
-    // Clear destination image and create new one with same size
-    dst.release();
-    dst = Image(src.width(), src.height());
-    
+std::vector<std::vector<float>> Convolution::rowsOf(const float* taps, int size) {
+    std::vector<std::vector<float>> rows;
+    for (int y = 0; y < size; y++) {
+        rows.emplace_back(taps + y * size, taps + (y + 1) * size);
+    }
+    return rows;
+}
+
+void Convolution::setMethod(Method method) {
+    m_method = method;
+    if (usesFft() && !m_fftKernel)
+        prepareFft();
+}
+
+Convolution::Method Convolution::method() const {
+    return m_method;
+}
+
+bool Convolution::usesFft() const {
+    return m_method == Method::Fft || (m_method == Method::Automatic && m_kernelSize >= kFftMinKernelSize);
+}
+
+// The direct path computes sum(src[y + ky - r][x + kx - r] * k[ky][kx]),
+// a correlation. A circular convolution with the kernel flipped and put in
+// the corner gives that sum at (y + size - 1, x + size - 1), so the flipped
+// kernel is what gets transformed.
+void Convolution::prepareFft() {
+    auto prepared = std::make_shared<FftKernel>();
+    auto fft = std::make_shared<RealFft2D>(fftSizeFor(m_kernelSize));
+    const unsigned int n = fft->size();
+    std::vector<float> padded(static_cast<size_t>(n) * n, 0.0f);
+    for (int ky = 0; ky < m_kernelSize; ++ky) {
+        for (int kx = 0; kx < m_kernelSize; ++kx) {
+            padded[static_cast<size_t>(m_kernelSize - 1 - ky) * n + (m_kernelSize - 1 - kx)] = m_kernel[ky][kx];
+        }
+    }
+    prepared->spectrum.resize(static_cast<size_t>(n) * fft->spectrumWidth());
+    fft->forward(padded.data(), prepared->spectrum.data());
+    prepared->fft = fft;
+    m_fftKernel = prepared;
+}
+
+bool Convolution::doProcess(ConstImageView src, ImageView dst) {
+    if (src.isEmpty() || dst.isEmpty()) {
+        return false;
+    }
+    if (dst.width() != src.width() || dst.height() != src.height()) {
+        return false;
+    }
+    return usesFft() ? processFft(src, dst) : processDirect(src, dst);
+}
+
+bool Convolution::processDirect(ConstImageView src, ImageView dst) {
+    const int width = static_cast<int>(src.width());
+    const int height = static_cast<int>(src.height());
+    const BorderMode mode = m_border.mode;
+    const unsigned char fill = mode == BorderMode::Constant ? m_border.value : 0;
+
     // Calculate how far to look around each pixel
     // For a 3x3 kernel, offset = 1 (look 1 pixel in each direction)
     // For a 5x5 kernel, offset = 2 (look 2 pixels in each direction)
-    int offset = m_kernelSize / 2;
+    const int offset = m_kernelSize / 2;
 
-    // Process each pixel in the image
-    for (unsigned int y = 0; y < src.height(); ++y) {
-        for (unsigned int x = 0; x < src.width(); ++x) {
-            // Initialize sum for this pixel's convolution
+    // Columns whose whole window lies inside the image; the others are the
+    // border strips, at most offset pixels wide on each side
+    const int interiorStart = std::min(offset, width);
+    const int interiorEnd = std::max(interiorStart, width - offset);
+
+    // Stands in for the rows above and below the image with Zero and
+    // Constant. Per thread, so that one filter can run on several images
+    // at once; the workers see their own fillRow, so pass the pointer
+    static thread_local std::vector<unsigned char> fillRow;
+    fillRow.assign(width, fill);
+    const unsigned char* outside = fillRow.data();
+
+    // Process each pixel in the image, walking the rows by stride.
+    // Bands of rows run in parallel, each reading offset rows around it
+    ThreadPool::instance().parallelFor(height, offset, [&](unsigned int firstRow, unsigned int endRow) {
+        // The rows under the kernel, with rows outside the image already
+        // mapped by the border mode, so the top and bottom edges need no checks
+        static thread_local std::vector<const unsigned char*> windowRows;
+        windowRows.resize(m_kernelSize);
+        const unsigned char** rows = windowRows.data();
+
+        // Slow path for the border strips: every tap is mapped on its own
+        auto borderPixel = [&](int x) {
             float sum = 0.0f;
-            
-            // Look at surrounding pixels based on kernel size
-            // For each pixel, we look at a window of pixels around it
-            for (int ky = -offset; ky <= offset; ++ky) {
-                for (int kx = -offset; kx <= offset; ++kx) {
-                    // Calculate position of the pixel we're looking at
-                    int srcX = x + kx;
-                    int srcY = y + ky;
-                    
-                    // Only process if the pixel is within image bounds
-                    // This handles the edges of the image
-                    if (srcX >= 0 && srcX < static_cast<int>(src.width()) &&
-                        srcY >= 0 && srcY < static_cast<int>(src.height())) {
-                        // Multiply the pixel value by the corresponding kernel value
-                        // and add to the sum
-                        sum += src.at(srcX, srcY) * 
-                               m_kernel[ky + offset][kx + offset];
+            for (int ky = 0; ky < m_kernelSize; ++ky) {
+                const float* kernelRow = m_kernel[ky].data();
+                for (int kx = 0; kx < m_kernelSize; ++kx) {
+                    int srcX = borderIndex(x + kx - offset, width, mode);
+                    sum += (srcX < 0 ? fill : rows[ky][srcX]) * kernelRow[kx];
+                }
+            }
+            return sum;
+        };
+
+        for (int y = static_cast<int>(firstRow); y < static_cast<int>(endRow); ++y) {
+            for (int ky = 0; ky < m_kernelSize; ++ky) {
+                int srcY = borderIndex(y + ky - offset, height, mode);
+                rows[ky] = srcY < 0 ? outside : src.row(srcY);
+            }
+            unsigned char* dstRow = dst.row(y);
+
+            for (int x = 0; x < interiorStart; ++x) {
+                dstRow[x] = static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, borderPixel(x))));
+            }
+
+            // Interior: the whole window is inside the row, no checks per
+            // tap. Sizes with a row function run it fully unrolled.
+            if (m_rowFunction) {
+                m_rowFunction(m_taps.data(), rows, dstRow, interiorStart, interiorEnd);
+            } else {
+                for (int x = interiorStart; x < interiorEnd; ++x) {
+                    // Initialize sum for this pixel's convolution
+                    float sum = 0.0f;
+
+                    // Multiply each pixel of the window by the corresponding
+                    // kernel value and add to the sum
+                    for (int ky = 0; ky < m_kernelSize; ++ky) {
+                        const unsigned char* srcRow = rows[ky] + x - offset;
+                        const float* kernelRow = m_kernel[ky].data();
+                        for (int kx = 0; kx < m_kernelSize; ++kx) {
+                            sum += srcRow[kx] * kernelRow[kx];
+                        }
                     }
+
+                    // Clamp the result to valid range [0, 255] and convert to byte
+                    dstRow[x] = static_cast<unsigned char>(
+                        std::min(255.0f, std::max(0.0f, sum)));
                 }
             }
-            
-            // Clamp the result to valid range [0, 255] and convert to byte
-            dst.at(x, y) = static_cast<unsigned char>(
-                std::min(255.0f, std::max(0.0f, sum)));
+
+            for (int x = interiorEnd; x < width; ++x) {
+                dstRow[x] = static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, borderPixel(x))));
+            }
         }
-    }
+    });
     return true;
-} 
\ No newline at end of file
+}
+
+// Overlap-save: each tile of output pixels reads its block of input, the
+// tile and its halo, which is the FFT size on a side, mapped by the border
+// mode like the direct path reads it. Only the part of the result that the
+// circular wrap-around does not reach is kept, which is the tile. Tiles
+// run in parallel, each thread with its own block and spectrum.
+bool Convolution::processFft(ConstImageView src, ImageView dst) {
+    const FftKernel& kernel = *m_fftKernel;
+    const RealFft2D& fft = *kernel.fft;
+    const int n = static_cast<int>(fft.size());
+    const int spectrumWidth = static_cast<int>(fft.spectrumWidth());
+    const int width = static_cast<int>(src.width());
+    const int height = static_cast<int>(src.height());
+    const int offset = m_kernelSize / 2;
+    const int tile = n - m_kernelSize + 1;
+    const int tilesX = (width + tile - 1) / tile;
+    const int tilesY = (height + tile - 1) / tile;
+    const BorderMode mode = m_border.mode;
+    const float fill = mode == BorderMode::Constant ? m_border.value : 0;
+
+    ThreadPool::instance().parallelForItems(tilesX * tilesY, [&](unsigned int first, unsigned int end) {
+        static thread_local std::vector<float> block;
+        static thread_local std::vector<std::complex<float>> spectrum;
+        block.resize(static_cast<size_t>(n) * n);
+        spectrum.resize(static_cast<size_t>(n) * spectrumWidth);
+
+        for (unsigned int index = first; index < end; index++) {
+            const int x0 = static_cast<int>(index) % tilesX * tile;
+            const int y0 = static_cast<int>(index) / tilesX * tile;
+
+            // Input block, columns inside the image copied straight and
+            // the others mapped one by one
+            const int copyStart = std::min(std::max(offset - x0, 0), n);
+            const int copyEnd = std::max(copyStart, std::min(n, width - x0 + offset));
+            for (int j = 0; j < n; j++) {
+                float* blockRow = block.data() + static_cast<size_t>(j) * n;
+                const int srcY = borderIndex(y0 - offset + j, height, mode);
+                if (srcY < 0) {
+                    std::fill(blockRow, blockRow + n, fill);
+                } else {
+                    const unsigned char* srcRow = src.row(srcY);
+                    for (int i = 0; i < copyStart; i++) {
+                        int srcX = borderIndex(x0 - offset + i, width, mode);
+                        blockRow[i] = srcX < 0 ? fill : srcRow[srcX];
+                    }
+                    const unsigned char* inside = srcRow + x0 - offset;
+                    for (int i = copyStart; i < copyEnd; i++) {
+                        blockRow[i] = inside[i];
+                    }
+                    for (int i = copyEnd; i < n; i++) {
+                        int srcX = borderIndex(x0 - offset + i, width, mode);
+                        blockRow[i] = srcX < 0 ? fill : srcRow[srcX];
+                    }
+                }
+            }
+
+            fft.forward(block.data(), spectrum.data());
+            const std::complex<float>* weights = kernel.spectrum.data();
+            for (size_t i = 0; i < spectrum.size(); i++) {
+                spectrum[i] *= weights[i];
+            }
+            fft.inverse(spectrum.data(), block.data());
+
+            const int tileWidth = std::min(tile, width - x0);
+            const int tileHeight = std::min(tile, height - y0);
+            for (int y = 0; y < tileHeight; y++) {
+                const float* result = block.data() + static_cast<size_t>(y + m_kernelSize - 1) * n + m_kernelSize - 1;
+                unsigned char* dstRow = dst.row(y0 + y) + x0;
+                for (int x = 0; x < tileWidth; x++) {
+                    dstRow[x] = static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, result[x])));
+                }
+            }
+        }
+    });
+    return true;
+}
+
+// A pixel reads offset pixels on each side, and with Wrap the pixels at
+// the edges read the far side of the image
+unsigned int Convolution::halo() const {
+    return m_border.mode == BorderMode::Wrap ? kUnboundedHalo : m_kernelSize / 2;
+}
@@ -0,0 +1,161 @@
+#include "Fft.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+
+std::complex<float> unitRoot(unsigned int k, unsigned int n) {
+    double angle = -2.0 * kPi * k / n;
+    return std::complex<float>(static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle)));
+}
+
+} // namespace
+
+RealFft2D::ComplexFft::ComplexFft(unsigned int length) : m_length(length), m_reversed(length), m_twiddles(length / 2) {
+    unsigned int bits = 0;
+    while ((1u << bits) < length) bits++;
+    for (unsigned int i = 0; i < length; i++) {
+        unsigned int reversed = 0;
+        for (unsigned int b = 0; b < bits; b++) {
+            reversed |= ((i >> b) & 1u) << (bits - 1 - b);
+        }
+        m_reversed[i] = reversed;
+    }
+    for (unsigned int k = 0; k < length / 2; k++) {
+        m_twiddles[k] = unitRoot(k, length);
+    }
+}
+
+// Decimation in time: bit-reversed order first, then butterflies of
+// doubling span, the twiddles of span s being every (length / 2s)th entry
+// of the table. The inverse uses the conjugate twiddles and is not scaled.
+void RealFft2D::ComplexFft::transform(std::complex<float>* data, bool inverse) const {
+    for (unsigned int i = 0; i < m_length; i++) {
+        if (i < m_reversed[i])
+            std::swap(data[i], data[m_reversed[i]]);
+    }
+    for (unsigned int half = 1; half < m_length; half *= 2) {
+        const unsigned int step = m_length / (2 * half);
+        for (unsigned int start = 0; start < m_length; start += 2 * half) {
+            for (unsigned int k = 0; k < half; k++) {
+                std::complex<float> w = inverse ? std::conj(m_twiddles[k * step]) : m_twiddles[k * step];
+                std::complex<float> odd = data[start + k + half] * w;
+                data[start + k + half] = data[start + k] - odd;
+                data[start + k] += odd;
+            }
+        }
+    }
+}
+
+RealFft2D::RealFft2D(unsigned int size)
+    : m_size(size), m_rows(size / 2), m_columns(size), m_split(size / 2 + 1) {
+    if (size < 4 || (size & (size - 1)) != 0)
+        throw std::invalid_argument("FFT size must be a power of two of at least 4");
+    for (unsigned int k = 0; k <= size / 2; k++) {
+        m_split[k] = unitRoot(k, size);
+    }
+}
+
+unsigned int RealFft2D::size() const {
+    return m_size;
+}
+
+unsigned int RealFft2D::spectrumWidth() const {
+    return m_size / 2 + 1;
+}
+
+// Each row x[0..n) is transformed as z[j] = x[2j] + i x[2j + 1], whose
+// spectrum Z holds the spectra of the even and odd samples:
+//   E[k] = (Z[k] + conj(Z[n/2 - k])) / 2,  O[k] = (Z[k] - conj(Z[n/2 - k])) / 2i
+//   X[k] = E[k] + exp(-2 pi i k / n) O[k]
+// The columns are then transformed together, a butterfly at a time over
+// whole rows, which keeps the memory accesses sequential.
+void RealFft2D::forward(const float* input, std::complex<float>* spectrum) const {
+    const unsigned int half = m_size / 2;
+    const unsigned int width = spectrumWidth();
+    for (unsigned int y = 0; y < m_size; y++) {
+        std::complex<float>* row = spectrum + static_cast<size_t>(y) * width;
+        const float* values = input + static_cast<size_t>(y) * m_size;
+        for (unsigned int j = 0; j < half; j++) {
+            row[j] = std::complex<float>(values[2 * j], values[2 * j + 1]);
+        }
+        m_rows.transform(row, false);
+
+        const std::complex<float> z0 = row[0];
+        row[half] = std::complex<float>(z0.real() - z0.imag(), 0.0f);
+        row[0] = std::complex<float>(z0.real() + z0.imag(), 0.0f);
+        for (unsigned int k = 1; k <= half / 2; k++) {
+            const std::complex<float> a = row[k], b = std::conj(row[half - k]);
+            const std::complex<float> even = (a + b) * 0.5f;
+            const std::complex<float> odd = (a - b) * std::complex<float>(0.0f, -0.5f);
+            const std::complex<float> c = row[half - k], d = std::conj(row[k]);
+            const std::complex<float> evenMirror = (c + d) * 0.5f;
+            const std::complex<float> oddMirror = (c - d) * std::complex<float>(0.0f, -0.5f);
+            row[k] = even + m_split[k] * odd;
+            row[half - k] = evenMirror + m_split[half - k] * oddMirror;
+        }
+    }
+    transformColumns(spectrum, false);
+}
+
+// The steps of forward() undone in reverse order:
+//   E[k] = (X[k] + conj(X[n/2 - k])) / 2,  O[k] = (X[k] - conj(X[n/2 - k])) exp(2 pi i k / n) / 2
+//   Z[k] = E[k] + i O[k]
+void RealFft2D::inverse(std::complex<float>* spectrum, float* output) const {
+    const unsigned int half = m_size / 2;
+    const unsigned int width = spectrumWidth();
+    const float scale = 1.0f / (static_cast<float>(m_size) * m_size);
+    transformColumns(spectrum, true);
+    for (unsigned int y = 0; y < m_size; y++) {
+        std::complex<float>* row = spectrum + static_cast<size_t>(y) * width;
+        const std::complex<float> i(0.0f, 1.0f);
+        const std::complex<float> x0 = row[0], xHalf = std::conj(row[half]);
+        row[0] = (x0 + xHalf) * 0.5f + i * (x0 - xHalf) * 0.5f;
+        for (unsigned int k = 1; k <= half / 2; k++) {
+            const std::complex<float> a = row[k], b = std::conj(row[half - k]);
+            const std::complex<float> c = row[half - k], d = std::conj(row[k]);
+            row[k] = (a + b) * 0.5f + i * (a - b) * std::conj(m_split[k]) * 0.5f;
+            row[half - k] = (c + d) * 0.5f + i * (c - d) * std::conj(m_split[half - k]) * 0.5f;
+        }
+        m_rows.transform(row, true);
+
+        float* values = output + static_cast<size_t>(y) * m_size;
+        for (unsigned int j = 0; j < half; j++) {
+            values[2 * j] = row[j].real() * 2.0f * scale;
+            values[2 * j + 1] = row[j].imag() * 2.0f * scale;
+        }
+    }
+}
+
+// Same butterflies as ComplexFft::transform, applied to every column at
+// once: element i of the column transform is row i
+void RealFft2D::transformColumns(std::complex<float>* data, bool inverse) const {
+    const unsigned int width = spectrumWidth();
+    const unsigned int* reversed = m_columns.reversed();
+    const std::complex<float>* twiddles = m_columns.twiddles();
+    auto row = [&](unsigned int i) { return data + static_cast<size_t>(i) * width; };
+
+    for (unsigned int i = 0; i < m_size; i++) {
+        if (i < reversed[i])
+            std::swap_ranges(row(i), row(i) + width, row(reversed[i]));
+    }
+    for (unsigned int half = 1; half < m_size; half *= 2) {
+        const unsigned int step = m_size / (2 * half);
+        for (unsigned int start = 0; start < m_size; start += 2 * half) {
+            for (unsigned int k = 0; k < half; k++) {
+                const std::complex<float> w = inverse ? std::conj(twiddles[k * step]) : twiddles[k * step];
+                std::complex<float>* top = row(start + k);
+                std::complex<float>* bottom = row(start + k + half);
+                for (unsigned int x = 0; x < width; x++) {
+                    std::complex<float> odd = bottom[x] * w;
+                    bottom[x] = top[x] - odd;
+                    top[x] += odd;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <vector>
+
+/**
+ * @brief Two-dimensional FFT of real square images with a power-of-two side
+ *
+ * Iterative radix-2 transforms in single precision. A real row of n values
+ * is transformed as n / 2 complex values and then split into its spectrum,
+ * so only the n / 2 + 1 non-redundant columns of the spectrum are kept and
+ * the columns are transformed as complex data. The tables are built once in
+ * the constructor; transforms allocate nothing and can run on several
+ * threads at once.
+ */
+class RealFft2D {
+public:
+    /**
+     * @brief Constructor
+     * @param size Side of the images, a power of two of at least 4
+     */
+    explicit RealFft2D(unsigned int size);
+
+    /**
+     * @brief Side of the images
+     */
+    unsigned int size() const;
+
+    /**
+     * @brief Number of complex columns of a spectrum, size() / 2 + 1
+     */
+    unsigned int spectrumWidth() const;
+
+    /**
+     * @brief Forward transform
+     * @param input size() rows of size() values
+     * @param spectrum Receives size() rows of spectrumWidth() values
+     */
+    void forward(const float* input, std::complex<float>* spectrum) const;
+
+    /**
+     * @brief Inverse transform, scaled so that it undoes forward()
+     * @param spectrum size() rows of spectrumWidth() values, overwritten
+     * @param output Receives size() rows of size() values
+     */
+    void inverse(std::complex<float>* spectrum, float* output) const;
+
+private:
+    /**
+     * @brief Complex transform of a power-of-two length
+     */
+    class ComplexFft {
+    public:
+        explicit ComplexFft(unsigned int length);
+        void transform(std::complex<float>* data, bool inverse) const;
+        const unsigned int* reversed() const { return m_reversed.data(); }
+        const std::complex<float>* twiddles() const { return m_twiddles.data(); }
+
+    private:
+        unsigned int m_length;
+        std::vector<unsigned int> m_reversed;        // bit-reversed index of each index
+        std::vector<std::complex<float>> m_twiddles; // exp(-2 pi i k / length) for k < length / 2
+    };
+
+    /**
+     * @brief Complex transform of every column of a spectrum
+     */
+    void transformColumns(std::complex<float>* data, bool inverse) const;
+
+    unsigned int m_size;
+    ComplexFft m_rows;    // length size / 2, real rows packed two values per complex value
+    ComplexFft m_columns; // length size
+    std::vector<std::complex<float>> m_split; // exp(-2 pi i k / size) for k <= size / 2
+};
+
+#endif // FFT_H
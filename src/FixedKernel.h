@@ -0,0 +1,127 @@
+#ifndef FIXED_KERNEL_H
+#define FIXED_KERNEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+/**
+ * @brief Square convolution kernel whose size is a compile-time constant
+ *
+ * Taps are stored row-major in a plain array, so a kernel can be constexpr
+ * and loops over it have a constant trip count. Convolution runs 3x3, 5x5
+ * and 7x7 kernels through the row functions below, with every tap unrolled;
+ * for the constexpr kernels of FixedKernels the zero taps are dropped at
+ * compile time as well.
+ */
+template <int N>
+struct FixedKernel {
+    static_assert(N > 0 && N % 2 == 1, "Kernel size must be odd");
+    static const int kSize = N;
+
+    float taps[N * N];
+
+    constexpr float at(int y, int x) const { return taps[y * N + x]; }
+};
+
+/**
+ * @brief Common filters as constexpr kernels
+ */
+namespace FixedKernels {
+
+constexpr FixedKernel<3> kSobelX = {{-1, 0, 1, -2, 0, 2, -1, 0, 1}};
+constexpr FixedKernel<3> kSobelY = {{-1, -2, -1, 0, 0, 0, 1, 2, 1}};
+constexpr FixedKernel<3> kLaplacian = {{0, 1, 0, 1, -4, 1, 0, 1, 0}};
+constexpr FixedKernel<3> kSharpen = {{0, -1, 0, -1, 5, -1, 0, -1, 0}};
+
+namespace detail {
+
+template <int N, size_t... I>
+constexpr FixedKernel<N> box(std::index_sequence<I...>) {
+    return {{(static_cast<void>(I), 1.0f / (N * N))...}};
+}
+
+// Outer product of a row of binomial coefficients with itself, divided by
+// the square of their sum; every tap is a power-of-two fraction, exact in float
+template <int N, size_t... I>
+constexpr FixedKernel<N> binomial(const int (&row)[N], std::index_sequence<I...>) {
+    return {{static_cast<float>(row[I / N] * row[I % N]) / static_cast<float>(1 << (2 * (N - 1)))...}};
+}
+
+} // namespace detail
+
+constexpr FixedKernel<3> kBox3 = detail::box<3>(std::make_index_sequence<9>());
+constexpr FixedKernel<5> kBox5 = detail::box<5>(std::make_index_sequence<25>());
+constexpr FixedKernel<7> kBox7 = detail::box<7>(std::make_index_sequence<49>());
+
+constexpr int kBinomialRow3[3] = {1, 2, 1};
+constexpr int kBinomialRow5[5] = {1, 4, 6, 4, 1};
+constexpr int kBinomialRow7[7] = {1, 6, 15, 20, 15, 6, 1};
+constexpr FixedKernel<3> kGaussian3 = detail::binomial<3>(kBinomialRow3, std::make_index_sequence<9>());
+constexpr FixedKernel<5> kGaussian5 = detail::binomial<5>(kBinomialRow5, std::make_index_sequence<25>());
+constexpr FixedKernel<7> kGaussian7 = detail::binomial<7>(kBinomialRow7, std::make_index_sequence<49>());
+
+} // namespace FixedKernels
+
+/**
+ * @brief Interior output pixels [begin, end) of one row
+ * rows[ky] points to the input row under kernel row ky; begin and end must
+ * leave N / 2 valid pixels on each side. taps are the kernel's N * N taps,
+ * ignored by the constant-kernel variant.
+ */
+using FixedRowFunction = void (*)(const float* taps, const unsigned char* const* rows, unsigned char* dst,
+                                  int begin, int end);
+
+namespace FixedKernels {
+namespace detail {
+
+inline unsigned char clampToByte(float value) {
+    return static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, value)));
+}
+
+// Taps in row-major order, the order of the generic loop, so the sums are
+// the same to the last bit
+template <int N, size_t... I>
+inline float sumTaps(const float* taps, const unsigned char* const* rows, int x, std::index_sequence<I...>) {
+    float sum = 0.0f;
+    ((sum += rows[I / N][x - N / 2 + static_cast<int>(I % N)] * taps[I]), ...);
+    return sum;
+}
+
+template <int N, const FixedKernel<N>& K, size_t I>
+inline void addTap(float& sum, const unsigned char* const* rows, int x) {
+    if constexpr (K.taps[I] != 0.0f)
+        sum += rows[I / N][x - N / 2 + static_cast<int>(I % N)] * K.taps[I];
+}
+
+template <int N, const FixedKernel<N>& K, size_t... I>
+inline float sumConstantTaps(const unsigned char* const* rows, int x, std::index_sequence<I...>) {
+    float sum = 0.0f;
+    (addTap<N, K, I>(sum, rows, x), ...);
+    return sum;
+}
+
+} // namespace detail
+} // namespace FixedKernels
+
+/**
+ * @brief Row function for any N x N kernel, taps read from the taps argument
+ */
+template <int N>
+void fixedKernelRow(const float* taps, const unsigned char* const* rows, unsigned char* dst, int begin, int end) {
+    for (int x = begin; x < end; x++) {
+        dst[x] = FixedKernels::detail::clampToByte(FixedKernels::detail::sumTaps<N>(taps, rows, x, std::make_index_sequence<N * N>()));
+    }
+}
+
+/**
+ * @brief Row function for one constexpr kernel, its zero taps compiled out
+ */
+template <int N, const FixedKernel<N>& K>
+void constantKernelRow(const float*, const unsigned char* const* rows, unsigned char* dst, int begin, int end) {
+    for (int x = begin; x < end; x++) {
+        dst[x] = FixedKernels::detail::clampToByte(FixedKernels::detail::sumConstantTaps<N, K>(rows, x, std::make_index_sequence<N * N>()));
+    }
+}
+
+#endif // FIXED_KERNEL_H
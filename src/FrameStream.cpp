@@ -0,0 +1,323 @@
+#include "FrameStream.h"
+#include "BoundedQueue.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <thread>
+
+#if defined(_WIN32)
+#include <io.h>
+#define readDescriptor _read
+#define writeDescriptor _write
+#else
+#include <cerrno>
+#include <unistd.h>
+#define readDescriptor ::read
+#define writeDescriptor ::write
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// 64 KB, a pipe's default capacity on Linux
+const size_t kIoBufferSize = 64 * 1024;
+
+// Read up to size bytes, retrying when interrupted; 0 at the end, -1 on error
+long readSome(int fd, unsigned char* data, size_t size) {
+    for (;;) {
+        long got = static_cast<long>(readDescriptor(fd, data, static_cast<unsigned int>(std::min(size, size_t(1) << 30))));
+#if !defined(_WIN32)
+        if (got < 0 && errno == EINTR)
+            continue;
+#endif
+        return got;
+    }
+}
+
+bool writeAll(int fd, const unsigned char* data, size_t size) {
+    while (size > 0) {
+        long written = static_cast<long>(writeDescriptor(fd, data, static_cast<unsigned int>(std::min(size, size_t(1) << 30))));
+        if (written < 0) {
+#if !defined(_WIN32)
+            if (errno == EINTR)
+                continue;
+#endif
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+} // namespace
+
+FrameReader::FrameReader(int fd) : m_fd(fd), m_failed(false), m_buffer(kIoBufferSize), m_position(0), m_end(0) {}
+
+bool FrameReader::fill() {
+    long got = readSome(m_fd, m_buffer.data(), m_buffer.size());
+    if (got <= 0) {
+        m_failed = m_failed || got < 0;
+        return false;
+    }
+    m_position = 0;
+    m_end = static_cast<size_t>(got);
+    return true;
+}
+
+int FrameReader::nextByte() {
+    if (m_position == m_end && !fill())
+        return -1;
+    return m_buffer[m_position++];
+}
+
+// A number followed by whitespace or a comment, after any whitespace and
+// comments; the character after the number is consumed
+bool FrameReader::readHeaderField(unsigned int& value) {
+    int c = nextByte();
+    for (;;) {
+        if (c == '#') {
+            while (c != '\n' && c != -1) c = nextByte();
+        } else if (c != -1 && isspace(c)) {
+            c = nextByte();
+        } else {
+            break;
+        }
+    }
+    if (c == -1 || !isdigit(c))
+        return false;
+    unsigned long long parsed = 0;
+    while (c != -1 && isdigit(c)) {
+        parsed = parsed * 10 + (c - '0');
+        if (parsed > 0xffffffffull)
+            return false;
+        c = nextByte();
+    }
+    value = static_cast<unsigned int>(parsed);
+    if (c == '#') {
+        while (c != '\n' && c != -1) c = nextByte();
+    }
+    return c != -1 && isspace(c);
+}
+
+// Large reads skip the buffer and go straight into the destination
+bool FrameReader::readBytes(unsigned char* data, size_t size) {
+    for (;;) {
+        size_t available = std::min(size, m_end - m_position);
+        memcpy(data, m_buffer.data() + m_position, available);
+        m_position += available;
+        data += available;
+        size -= available;
+        if (size == 0)
+            return true;
+        if (size >= m_buffer.size()) {
+            long got = readSome(m_fd, data, size);
+            if (got <= 0)
+                return false;
+            data += got;
+            size -= static_cast<size_t>(got);
+            if (size == 0)
+                return true;
+        }
+        if (!fill())
+            return false;
+    }
+}
+
+// Whitespace between frames is skipped; a stream that ends there ends cleanly,
+// one that ends inside a frame has failed
+bool FrameReader::readFrame(Image& frame) {
+    m_failed = false;
+    int c = nextByte();
+    while (c != -1 && isspace(c)) {
+        c = nextByte();
+    }
+    if (c == -1)
+        return false;
+
+    unsigned int width, height, maxValue;
+    if (c != 'P' || nextByte() != '5' || !readHeaderField(width) || !readHeaderField(height) ||
+        !readHeaderField(maxValue) || maxValue == 0 || maxValue > 255 ||
+        width == 0 || height == 0 || width > kMaxFrameSide || height > kMaxFrameSide) {
+        m_failed = true;
+        return false;
+    }
+
+    if (frame.width() != width || frame.height() != height)
+        frame = Image(width, height);
+    for (unsigned int y = 0; y < height; y++) {
+        if (!readBytes(frame.row(y), width)) {
+            m_failed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FrameReader::failed() const {
+    return m_failed;
+}
+
+FrameWriter::FrameWriter(int fd) : m_fd(fd), m_buffer(kIoBufferSize), m_used(0) {}
+
+bool FrameWriter::flush() {
+    bool ok = writeAll(m_fd, m_buffer.data(), m_used);
+    m_used = 0;
+    return ok;
+}
+
+bool FrameWriter::append(const unsigned char* data, size_t size) {
+    if (m_used + size > m_buffer.size() && !flush())
+        return false;
+    if (size >= m_buffer.size())
+        return writeAll(m_fd, data, size);
+    memcpy(m_buffer.data() + m_used, data, size);
+    m_used += size;
+    return true;
+}
+
+// Same header as Image::save; formatted on the stack so that writing a
+// frame does not allocate
+bool FrameWriter::writeFrame(const Image& frame) {
+    char header[64];
+    int length = snprintf(header, sizeof(header), "P5\n%u %u\n255\n", frame.width(), frame.height());
+    bool ok = append(reinterpret_cast<const unsigned char*>(header), static_cast<size_t>(length));
+    for (unsigned int y = 0; ok && y < frame.height(); y++) {
+        ok = append(frame.row(y), frame.width());
+    }
+    return flush() && ok;
+}
+
+LatencyHistogram::LatencyHistogram() : m_count(0), m_max(0.0) {
+    m_buckets.fill(0);
+}
+
+void LatencyHistogram::add(double microseconds) {
+    int bucket = microseconds > 1.0 ? static_cast<int>(std::log2(microseconds) * 16.0) : 0;
+    m_buckets[std::min(bucket, kBuckets - 1)]++;
+    m_count++;
+    m_max = std::max(m_max, microseconds);
+}
+
+double LatencyHistogram::percentile(double fraction) const {
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * m_count)));
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; i++) {
+        seen += m_buckets[i];
+        if (seen >= rank)
+            return std::min(m_max, std::exp2((i + 1) / 16.0));
+    }
+    return m_max;
+}
+
+uint64_t LatencyHistogram::count() const {
+    return m_count;
+}
+
+double LatencyHistogram::max() const {
+    return m_max;
+}
+
+// Image indices travel between the threads: free input slots to the
+// reader, filled ones to the processor, free output slots to the
+// processor, filled ones to the writer. A thread that stops closes the
+// queues around it so that the others wind down instead of waiting.
+StreamStats runStream(ImageProcessing& processor, int inputFd, int outputFd, unsigned int ringSize) {
+    struct Slot {
+        unsigned int index = 0;
+        Clock::time_point ready;
+    };
+
+    ringSize = std::max(2u, ringSize);
+    std::vector<Image> inputs(ringSize), outputs(ringSize);
+    BoundedQueue<unsigned int> freeInputs(ringSize), freeOutputs(ringSize);
+    BoundedQueue<Slot> toProcess(ringSize), toWrite(ringSize);
+    for (unsigned int i = 0; i < ringSize; i++) {
+        freeInputs.push(i);
+        freeOutputs.push(i);
+    }
+
+    StreamStats stats;
+    bool readFailed = false, writeFailed = false, processFailed = false;
+    const Clock::time_point start = Clock::now();
+
+    std::thread reader([&] {
+        try {
+            FrameReader frames(inputFd);
+            unsigned int index;
+            while (freeInputs.pop(index)) {
+                if (!frames.readFrame(inputs[index])) {
+                    readFailed = frames.failed();
+                    break;
+                }
+                Slot slot;
+                slot.index = index;
+                slot.ready = Clock::now();
+                if (!toProcess.push(slot))
+                    break;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error reading frame: " << e.what() << std::endl;
+            readFailed = true;
+        }
+        toProcess.close();
+    });
+
+    std::thread writer([&] {
+        try {
+            FrameWriter frames(outputFd);
+            Slot slot;
+            while (toWrite.pop(slot)) {
+                if (!frames.writeFrame(outputs[slot.index])) {
+                    writeFailed = true;
+                    break;
+                }
+                stats.latency.add(std::chrono::duration<double, std::micro>(Clock::now() - slot.ready).count());
+                stats.frames++;
+                freeOutputs.push(slot.index);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error writing frame: " << e.what() << std::endl;
+            writeFailed = true;
+        }
+        if (writeFailed)
+            toWrite.close();
+        freeOutputs.close();
+    });
+
+    Slot slot;
+    while (toProcess.pop(slot)) {
+        unsigned int output;
+        if (!freeOutputs.pop(output))
+            break;
+        try {
+            processFailed = !processor.process(inputs[slot.index], outputs[output]);
+        } catch (const std::exception& e) {
+            std::cerr << "Error processing frame: " << e.what() << std::endl;
+            processFailed = true;
+        }
+        freeInputs.push(slot.index);
+        if (processFailed)
+            break;
+        Slot processed;
+        processed.index = output;
+        processed.ready = slot.ready;
+        if (!toWrite.push(processed))
+            break;
+    }
+    freeInputs.close();
+    toProcess.close();
+    toWrite.close();
+
+    reader.join();
+    writer.join();
+    stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    stats.failed = readFailed || writeFailed || processFailed;
+    return stats;
+}
@@ -0,0 +1,144 @@
+#ifndef FRAME_STREAM_H
+#define FRAME_STREAM_H
+
+#include "Image.h"
+#include "ImageProcessing.h"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Reads binary PGM frames written back to back on a file descriptor
+ *
+ * Works on pipes: the header is parsed from an internal buffer instead of
+ * by seeking. Frames are read into a caller-provided image that is only
+ * reallocated when the frame size changes.
+ */
+class FrameReader {
+public:
+    /**
+     * @brief Constructor
+     * @param fd File descriptor to read from, not closed by the reader
+     */
+    explicit FrameReader(int fd);
+
+    /**
+     * @brief Largest width or height accepted from a frame header
+     */
+    static const unsigned int kMaxFrameSide = 16384;
+
+    /**
+     * @brief Read the next frame
+     * A header with a zero side or one above kMaxFrameSide fails the read
+     * before anything is allocated for it
+     * @param frame Receives the pixels, resized only if the size changed
+     * @return true if a frame was read, false at the end of the stream or on an error
+     */
+    bool readFrame(Image& frame);
+
+    /**
+     * @brief Check whether the last readFrame failed on bad or truncated data
+     * rather than at a clean end of stream
+     */
+    bool failed() const;
+
+private:
+    int nextByte();
+    bool readHeaderField(unsigned int& value);
+    bool readBytes(unsigned char* data, size_t size);
+    bool fill();
+
+    int m_fd;
+    bool m_failed;
+    std::vector<unsigned char> m_buffer;
+    size_t m_position;
+    size_t m_end;
+};
+
+/**
+ * @brief Writes binary PGM frames back to back on a file descriptor
+ */
+class FrameWriter {
+public:
+    /**
+     * @brief Constructor
+     * @param fd File descriptor to write to, not closed by the writer
+     */
+    explicit FrameWriter(int fd);
+
+    /**
+     * @brief Write a frame and flush it
+     * @return true if the whole frame was written, false otherwise
+     */
+    bool writeFrame(const Image& frame);
+
+private:
+    bool append(const unsigned char* data, size_t size);
+    bool flush();
+
+    int m_fd;
+    std::vector<unsigned char> m_buffer;
+    size_t m_used;
+};
+
+/**
+ * @brief Histogram of durations on a logarithmic scale for percentiles
+ * Fixed memory whatever the number of samples; percentiles are accurate
+ * to the bucket width of about 4.4%.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    /**
+     * @brief Record one duration
+     * @param microseconds Duration in microseconds
+     */
+    void add(double microseconds);
+
+    /**
+     * @brief Duration below which a fraction of the samples lie
+     * @param fraction Fraction in [0, 1], 0.5 for the median
+     * @return Upper bound of the bucket holding the percentile, in microseconds
+     */
+    double percentile(double fraction) const;
+
+    uint64_t count() const;
+    double max() const;
+
+private:
+    static const int kBuckets = 512; // 1 us to over an hour in steps of 2^(1/16)
+    std::array<uint64_t, kBuckets> m_buckets;
+    uint64_t m_count;
+    double m_max;
+};
+
+/**
+ * @brief Statistics of a stream run
+ */
+struct StreamStats {
+    uint64_t frames = 0;
+    bool failed = false;           // bad input, a processing or a write error
+    double seconds = 0.0;          // wall time
+    LatencyHistogram latency;      // from a frame fully read to its output written
+};
+
+/**
+ * @brief Process a stream of frames with reading, processing and writing overlapped
+ *
+ * A reader thread fills a ring of input images, the calling thread
+ * processes them into a ring of output images, and a writer thread sends
+ * those out, so reading frame N+1 and writing frame N-1 overlap with
+ * processing frame N. Images go round the rings instead of being freed,
+ * so once the frame size is stable no memory is allocated per frame.
+ * An exception on any of the threads fails the run like a bad frame:
+ * the queues are closed and the frames already processed are written.
+ * @param processor Processor run on every frame, may use the ThreadPool
+ * @param inputFd Descriptor the frames are read from
+ * @param outputFd Descriptor the processed frames are written to
+ * @param ringSize Images in each ring, at least 2
+ * @return Frame count, wall time and latency distribution
+ */
+StreamStats runStream(ImageProcessing& processor, int inputFd, int outputFd, unsigned int ringSize = 3);
+
+#endif // FRAME_STREAM_H
@@ -1,9 +1,12 @@
 #ifndef GAMMA_CORRECTION_H
 #define GAMMA_CORRECTION_H
 
-#include "ImageProcessing.h"
+#include "PointOp.h"
 
-class GammaCorrection : public ImageProcessing {
+/**
+ * @brief Gamma correction, a PointOp so it can be fused with other point operations
+ */
+class GammaCorrection : public PointOp {
 public:
     /**
      * @brief Constructor for gamma correction
@@ -11,13 +14,6 @@ public:
      */
     GammaCorrection(float gamma);
 
-    /**
-     * @brief Process the image using gamma correction
-     * @param src Source image
-     * @param dst Destination image
-     */
-    bool process(const Image& src, Image& dst) override;
-
     ~GammaCorrection();
 
 private:
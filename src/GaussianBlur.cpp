@@ -1,59 +1,203 @@
 #include "GaussianBlur.h"
+#include "ThreadPool.h"
+#include <algorithm>
 #include <cmath>
+#include <list>
+#include <mutex>
+#include <cstdint>
 
-GaussianBlur::GaussianBlur(int kernelSize, float sigma) : ImageProcessing() {
-    m_kernelSize = kernelSize;
-    m_sigma = sigma;
-    m_kernel = new float*[m_kernelSize];
-    for (int i = 0; i < m_kernelSize; i++) {
-        m_kernel[i] = new float[m_kernelSize];
+namespace {
+
+// Fixed-point layout of the two passes:
+//   horizontal: 8-bit pixel * Q14 weight, rounded down to Q8 so it fits 16 bits
+//   vertical:   Q8 row value * Q14 weight, truncated back to 8 bits at the end
+const int kWeightBits = 14;
+const int kRowBits = 8;
+const int kHorizontalShift = kWeightBits - kRowBits;
+const int kVerticalShift = kWeightBits + kRowBits;
+
+// Kernels kept for reuse; past this many parameter pairs the least recently
+// used one is dropped, blurs still holding it keep it alive
+const size_t kKernelCacheSize = 16;
+
+} // namespace
+
+// The 2D kernel exp(-(x*x + y*y) / (2*sigma*sigma)) normalized by its sum is
+// the outer product of the normalized 1D kernel with itself, so only the
+// 1D weights are built and shared between blurs with the same parameters
+std::shared_ptr<const GaussianBlur::Kernel> GaussianBlur::kernelFor(int kernelSize, float sigma) {
+    struct CacheEntry {
+        int kernelSize;
+        float sigma;
+        std::shared_ptr<const Kernel> kernel;
+    };
+    static std::mutex cacheMutex;
+    static std::list<CacheEntry> cache; // most recently used first
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->kernelSize == kernelSize && it->sigma == sigma) {
+            cache.splice(cache.begin(), cache, it);
+            return it->kernel;
+        }
     }
 
+    auto kernel = std::make_shared<Kernel>();
+    kernel->radius = kernelSize / 2;
+    int taps = 2 * kernel->radius + 1;
+
+    std::vector<float> values(taps);
     float sum = 0.0f;
-    int radius = m_kernelSize / 2;
-    for (int y = -radius; y <= radius; y++) {
-        for (int x = -radius; x <= radius; x++) {
-            float value = std::exp(-(x * x + y * y) / (2 * m_sigma * m_sigma));
-            m_kernel[y + radius][x + radius] = value;
-            sum += value;
-        }
+    for (int i = -kernel->radius; i <= kernel->radius; i++) {
+        float value = std::exp(-(i * i) / (2 * sigma * sigma));
+        values[i + kernel->radius] = value;
+        sum += value;
     }
 
-    for (int y = 0; y < m_kernelSize; y++) {
-        for (int x = 0; x < m_kernelSize; x++) {
-            m_kernel[y][x] /= sum;
-        }
+    // Round to fixed point and put the rounding error on the center tap so
+    // that a flat region keeps its exact value
+    kernel->weights.resize(taps);
+    int fixedSum = 0;
+    for (int i = 0; i < taps; i++) {
+        kernel->weights[i] = static_cast<int>(std::lround(values[i] / sum * (1 << kWeightBits)));
+        fixedSum += kernel->weights[i];
     }
+    kernel->weights[kernel->radius] += (1 << kWeightBits) - fixedSum;
+
+    cache.push_front(CacheEntry{kernelSize, sigma, kernel});
+    if (cache.size() > kKernelCacheSize)
+        cache.pop_back();
+    return kernel;
+}
+
+GaussianBlur::GaussianBlur(int kernelSize, float sigma, Border border) : ImageProcessing() {
+    m_kernelSize = kernelSize;
+    m_sigma = sigma;
+    m_border = border;
+    m_kernel = kernelFor(kernelSize, sigma);
 }
 
-GaussianBlur::~GaussianBlur() {
-    for (int i = 0; i < m_kernelSize; i++) {
-        delete[] m_kernel[i];
+GaussianBlur::~GaussianBlur() {}
+
+// The interior, where the whole window lies inside the row, runs without
+// any check; only the radius pixels at each end map their taps through the
+// border mode
+void GaussianBlur::filterRow(const unsigned char* src, uint16_t* dst, int width, const Kernel& kernel, Border border) {
+    const int radius = kernel.radius;
+    const int* weights = kernel.weights.data();
+    const unsigned char fill = border.mode == BorderMode::Constant ? border.value : 0;
+    const int interiorStart = std::min(radius, width);
+    const int interiorEnd = std::max(interiorStart, width - radius);
+
+    auto borderPixel = [&](int x) {
+        int sum = 0;
+        for (int k = -radius; k <= radius; k++) {
+            int i = borderIndex(x + k, width, border.mode);
+            sum += (i < 0 ? fill : src[i]) * weights[k + radius];
+        }
+        return static_cast<uint16_t>(sum >> kHorizontalShift);
+    };
+
+    for (int x = 0; x < interiorStart; x++) {
+        dst[x] = borderPixel(x);
+    }
+    for (int x = interiorStart; x < interiorEnd; x++) {
+        const unsigned char* window = src + x - radius;
+        int sum = 0;
+        for (int k = 0; k <= 2 * radius; k++) {
+            sum += window[k] * weights[k];
+        }
+        dst[x] = static_cast<uint16_t>(sum >> kHorizontalShift);
+    }
+    for (int x = interiorEnd; x < width; x++) {
+        dst[x] = borderPixel(x);
     }
-    delete[] m_kernel;
 }
 
-bool GaussianBlur::process(const Image& input, Image& output) {
+bool GaussianBlur::doProcess(ConstImageView input, ImageView output) {
     if (input.isEmpty() || output.isEmpty()) {
         return false;
     }
+    if (output.width() != input.width() || output.height() != input.height()) {
+        return false;
+    }
+
+    const int width = static_cast<int>(input.width());
+    const int height = static_cast<int>(input.height());
+    const Kernel& kernel = *m_kernel;
+    const int radius = kernel.radius;
+    const int taps = 2 * radius + 1;
+    const int* weights = kernel.weights.data();
+    const Border border = m_border;
+
+    // Each band of output rows keeps its own ring of horizontally filtered
+    // rows (row r lives in slot r % taps) and refilters the radius rows
+    // above it. The ring is per thread and kept between calls.
+    ThreadPool::instance().parallelFor(height, radius, [&](unsigned int firstRow, unsigned int endRow) {
+        static thread_local std::vector<uint16_t> rows;
+        static thread_local std::vector<uint16_t> outsideRows; // radius rows above the image, then radius below
+        static thread_local std::vector<const uint16_t*> window;
+        static thread_local std::vector<uint32_t> accumulator;
+        rows.resize(static_cast<size_t>(taps) * width);
+        outsideRows.resize(static_cast<size_t>(2 * radius) * width);
+        window.resize(taps);
+        accumulator.resize(width);
+        int nextRow = std::max(0, static_cast<int>(firstRow) - radius);
+
+        // The rows outside the image that this band reaches, filtered once
+        // from the rows the border mode maps them to. A constant row stays
+        // the same constant in Q8, since the weights sum to one.
+        auto outsideRow = [&](int v) {
+            return outsideRows.data() + static_cast<size_t>(v < 0 ? v + radius : radius + v - height) * width;
+        };
+        for (int v = static_cast<int>(firstRow) - radius; v < static_cast<int>(endRow) + radius; v++) {
+            if (v >= 0 && v < height)
+                continue;
+            int source = borderIndex(v, height, border.mode);
+            if (source < 0) {
+                uint16_t value = static_cast<uint16_t>((border.mode == BorderMode::Constant ? border.value : 0) << kRowBits);
+                std::fill(outsideRow(v), outsideRow(v) + width, value);
+            } else {
+                filterRow(input.row(source), outsideRow(v), width, kernel, border);
+            }
+        }
 
-    int radius = m_kernelSize / 2;
-    for (unsigned int y = 0; y < input.height(); y++) {
-        for (unsigned int x = 0; x < input.width(); x++) {
-            float sum = 0.0f;
-            for (int ky = -radius; ky <= radius; ky++) {
-                for (int kx = -radius; kx <= radius; kx++) {
-                    int px = x + kx;
-                    int py = y + ky;
-                    if (px >= 0 && px < static_cast<int>(input.width()) && py >= 0 && py < static_cast<int>(input.height())) {
-                        sum += input.at(px, py) * m_kernel[ky + radius][kx + radius];
-                    }
+        for (int y = static_cast<int>(firstRow); y < static_cast<int>(endRow); y++) {
+            // Horizontal pass for every row the vertical window now reaches
+            int lastRow = std::min(y + radius, height - 1);
+            for (; nextRow <= lastRow; nextRow++) {
+                filterRow(input.row(nextRow), rows.data() + static_cast<size_t>(nextRow % taps) * width,
+                          width, kernel, border);
+            }
+
+            // Vertical pass over the whole window, rows outside the image
+            // coming from outsideRows
+            for (int k = -radius; k <= radius; k++) {
+                int v = y + k;
+                window[k + radius] = v >= 0 && v < height ? rows.data() + static_cast<size_t>(v % taps) * width
+                                                          : outsideRow(v);
+            }
+            std::fill(accumulator.begin(), accumulator.end(), 0u);
+            for (int k = 0; k < taps; k++) {
+                const uint16_t* src = window[k];
+                uint32_t weight = static_cast<uint32_t>(weights[k]);
+                for (int x = 0; x < width; x++) {
+                    accumulator[x] += src[x] * weight;
                 }
             }
-            output.at(x, y) = static_cast<unsigned char>(sum);
+
+            unsigned char* dst = output.row(y);
+            for (int x = 0; x < width; x++) {
+                dst[x] = static_cast<unsigned char>(accumulator[x] >> kVerticalShift);
+            }
         }
-    }
+    });
 
     return true;
-} 
\ No newline at end of file
+}
+
+// A pixel reads radius pixels on each side, and with Wrap the pixels at
+// the edges read the far side of the image
+unsigned int GaussianBlur::halo() const {
+    return m_border.mode == BorderMode::Wrap ? kUnboundedHalo : static_cast<unsigned int>(m_kernel->radius);
+}
@@ -2,17 +2,54 @@
 #define GAUSSIAN_BLUR_H
 
 #include "ImageProcessing.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 class GaussianBlur : public ImageProcessing {
 public:
-    GaussianBlur(int kernelSize, float sigma);
+    /**
+     * @brief Constructor for Gaussian blur
+     * @param kernelSize Size of the (square) kernel, the radius is kernelSize / 2
+     * @param sigma Standard deviation of the Gaussian
+     * @param border What the kernel reads outside the image
+     */
+    GaussianBlur(int kernelSize, float sigma, Border border = Border());
     ~GaussianBlur();
-    bool process(const Image& input, Image& output) override;
+
+    /**
+     * @brief Kernel radius, unbounded with BorderMode::Wrap
+     */
+    unsigned int halo() const override;
+
+protected:
+    /**
+     * @brief Blur the image with a horizontal and a vertical 1D pass
+     * @param input Source image
+     * @param output Destination image, must have the size of input
+     */
+    bool doProcess(ConstImageView input, ImageView output) override;
 
 private:
-    float** m_kernel;
+    /**
+     * @brief Separable fixed-point kernel shared between blurs with equal parameters
+     */
+    struct Kernel {
+        int radius;
+        std::vector<int> weights; // Q14 fixed point, sums to 1 << 14
+    };
+
+    static std::shared_ptr<const Kernel> kernelFor(int kernelSize, float sigma);
+
+    /**
+     * @brief Horizontal pass of one row into Q8 values
+     */
+    static void filterRow(const unsigned char* src, uint16_t* dst, int width, const Kernel& kernel, Border border);
+
+    std::shared_ptr<const Kernel> m_kernel;
     int m_kernelSize;
     float m_sigma;
+    Border m_border;
 };
 
-#endif // GAUSSIAN_BLUR_H 
\ No newline at end of file
+#endif // GAUSSIAN_BLUR_H
@@ -1,34 +1,208 @@
 #include "Image.h"
+#include "Instrumentation.h"
 #include <fstream>
 #include <algorithm>
 #include <stdexcept>
 #include <sstream>
 #include <iostream>
 #include <cstring>
+#include <cctype>
+#include <new>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define IMAGE_POSIX_IO 1
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
+namespace {
+
+// Row buffers are allocated with the row alignment so that every row start,
+// not only the first one, is aligned
+unsigned char* allocateAligned(size_t size) {
+    return static_cast<unsigned char*>(::operator new[](size, std::align_val_t(Image::kRowAlignment)));
+}
+
+void freeAligned(unsigned char* data) {
+    ::operator delete[](data, std::align_val_t(Image::kRowAlignment));
+}
+
+#ifdef IMAGE_POSIX_IO
+
+// Skip the whitespace and comments in front of the next header field
+size_t skipSeparators(const unsigned char* data, size_t size, size_t pos) {
+    while (pos < size) {
+        if (data[pos] == '#') {
+            while (pos < size && data[pos] != '\n') pos++;
+        } else if (isspace(data[pos])) {
+            pos++;
+        } else {
+            break;
+        }
+    }
+    return pos;
+}
+
+bool parseHeaderField(const unsigned char* data, size_t size, size_t& pos, unsigned int& value) {
+    pos = skipSeparators(data, size, pos);
+    if (pos >= size || !isdigit(data[pos]))
+        return false;
+    unsigned long long parsed = 0;
+    while (pos < size && isdigit(data[pos])) {
+        parsed = parsed * 10 + (data[pos++] - '0');
+        if (parsed > 0xffffffffull)
+            return false;
+    }
+    value = static_cast<unsigned int>(parsed);
+    return true;
+}
+
+// Header of a binary 8-bit PGM: "P5", width, height and maximum value,
+// then exactly one whitespace character before the pixels
+bool parsePgmHeader(const unsigned char* data, size_t size, unsigned int& width, unsigned int& height,
+                    size_t& payloadOffset) {
+    if (size < 2 || data[0] != 'P' || data[1] != '5')
+        return false;
+    size_t pos = 2;
+    unsigned int maxValue;
+    if (!parseHeaderField(data, size, pos, width) || !parseHeaderField(data, size, pos, height) ||
+        !parseHeaderField(data, size, pos, maxValue))
+        return false;
+    if (maxValue == 0 || maxValue > 255 || pos >= size || !isspace(data[pos]))
+        return false;
+    payloadOffset = pos + 1;
+    return true;
+}
+
+// Write all of size bytes at offset, going on after short writes
+bool writeAt(int fd, const unsigned char* data, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+        offset += written;
+    }
+    return true;
+}
+
+#endif // IMAGE_POSIX_IO
+
+} // namespace
+
 // Default constructor - creates an empty image with no data
-Image::Image() : m_width(0), m_height(0), m_data(nullptr) {}
+Image::Image() : m_data(nullptr), m_width(0), m_height(0), m_stride(0),
+                 m_paddingRight(0), m_paddingBottom(0) {}
 
 // Constructor that creates an image of specified dimensions
-// All pixels are initialized to 0 (black)
-Image::Image(unsigned int width, unsigned int height) : m_width(width), m_height(height) {
-    m_data = new unsigned char[width * height];
-    memset(m_data, 0, width * height);
+// All pixels, padding included, are initialized to 0 (black)
+Image::Image(unsigned int width, unsigned int height, unsigned int paddingRight, unsigned int paddingBottom)
+    : Image() {
+    allocate(width, height, paddingRight, paddingBottom);
+}
+
+// Constructor over caller-provided memory
+// The bytes between the end of a row and the start of the next one count
+// as right padding; there are no padding rows
+Image::Image(unsigned char* data, unsigned int width, unsigned int height, unsigned int stride,
+             std::function<void(unsigned char*)> deleter)
+    : Image() {
+    if (stride < width)
+        throw std::invalid_argument("Stride must be at least the image width");
+    m_data = data;
+    m_width = width;
+    m_height = height;
+    m_stride = stride;
+    m_paddingRight = stride - width;
+    m_deleter = std::move(deleter);
 }
 
 // Copy constructor - creates a deep copy of another image
-// Ensures that each image has its own copy of the data
-Image::Image(const Image &other) : m_width(other.m_width), m_height(other.m_height) {
-    m_data = new unsigned char[m_width * m_height];
-    memcpy(m_data, other.m_data, m_width * m_height);
+// Ensures that each image has its own copy of the data, with the same layout
+Image::Image(const Image &other) : Image() {
+    allocate(other.m_width, other.m_height, other.m_paddingRight, other.m_paddingBottom);
+    copyPixels(other);
+}
+
+// Move constructor - takes over the buffer, no pixels are copied
+Image::Image(Image &&other) noexcept : Image() {
+    swap(other);
 }
 
 // Destructor - clean up allocated memory
 // Called automatically when image goes out of scope
 Image::~Image() {
-    delete[] m_data;
+    freeData();
+}
+
+// Exchange buffers and layouts with another image
+void Image::swap(Image& other) noexcept {
+    std::swap(m_data, other.m_data);
+    std::swap(m_width, other.m_width);
+    std::swap(m_height, other.m_height);
+    std::swap(m_stride, other.m_stride);
+    std::swap(m_paddingRight, other.m_paddingRight);
+    std::swap(m_paddingBottom, other.m_paddingBottom);
+    m_deleter.swap(other.m_deleter);
+}
+
+// Free the buffer through whoever owns it; borrowed buffers are left alone
+void Image::freeData() {
+    if (m_deleter && m_data)
+        m_deleter(m_data);
+    m_deleter = nullptr;
+    m_data = nullptr;
+}
+
+// Copy the pixels of an image of the same size
+// Same layout copies the buffer in one go, padding included; a caller-provided
+// buffer may have any stride, so its rows are copied one by one
+void Image::copyPixels(const Image& other) {
+    if (!m_data || !other.m_data)
+        return;
+    if (m_stride == other.m_stride) {
+        memcpy(m_data, other.m_data, static_cast<size_t>(m_stride) * m_height);
+        return;
+    }
+    for (unsigned int y = 0; y < m_height; ++y) {
+        memcpy(m_data + static_cast<size_t>(y) * m_stride,
+               other.m_data + static_cast<size_t>(y) * other.m_stride, m_width);
+    }
+}
+
+// Replace the pixel buffer with a zero-filled one of the given layout
+// The stride is the padded width rounded up to the row alignment
+void Image::allocate(unsigned int width, unsigned int height, unsigned int paddingRight, unsigned int paddingBottom) {
+    freeData();
+    m_width = width;
+    m_height = height;
+    m_paddingRight = paddingRight;
+    m_paddingBottom = paddingBottom;
+    m_stride = (width + paddingRight + kRowAlignment - 1) / kRowAlignment * kRowAlignment;
+
+    size_t size = static_cast<size_t>(m_stride) * (height + paddingBottom);
+    if (size == 0)
+        return;
+    m_data = allocateAligned(size);
+#ifdef IMAGE_INSTRUMENTATION
+    Instrumentation::imageAllocated(size);
+    m_deleter = [size](unsigned char* data) {
+        Instrumentation::imageFreed(size);
+        freeAligned(data);
+    };
+#else
+    m_deleter = freeAligned;
+#endif
+    memset(m_data, 0, size);
 }
 
 // Load a PGM (Portable Gray Map) image file
@@ -53,14 +227,35 @@ bool Image::load(const std::string& filename) {
         return false;
     }
 
-    file >> m_width >> m_height;
-    int maxVal;
-    file >> maxVal;
-    file.ignore();
+    unsigned int width = 0, height = 0;
+    int maxVal = 0;
+    file >> width >> height >> maxVal;
+    if (!file || width == 0 || height == 0 || maxVal < 1 || maxVal > 255 || !isspace(file.get())) {
+        std::cerr << "Not a PGM file" << std::endl;
+        return false;
+    }
+
+    // The header size is only checked against what the file holds, before
+    // anything is allocated for it
+    const std::streampos payload = file.tellg();
+    file.seekg(0, std::ios::end);
+    const std::streamoff available = file.tellg() - payload;
+    file.seekg(payload);
+    if (!file || static_cast<unsigned long long>(width) * height > static_cast<unsigned long long>(available)) {
+        std::cerr << "Truncated PGM file: " << filename << std::endl;
+        return false;
+    }
 
-    delete[] m_data;
-    m_data = new unsigned char[m_width * m_height];
-    file.read(reinterpret_cast<char*>(m_data), m_width * m_height);
+    // The file is packed, rows are read one by one to their padded position
+    allocate(width, height, m_paddingRight, m_paddingBottom);
+    for (unsigned int y = 0; y < m_height; ++y) {
+        file.read(reinterpret_cast<char*>(row(y)), m_width);
+    }
+    if (!file) {
+        std::cerr << "Error reading file: " << filename << std::endl;
+        release();
+        return false;
+    }
 
     return true;
 }
@@ -75,109 +270,134 @@ bool Image::save(const std::string& filename) const {
     }
 
     file << "P5\n" << m_width << " " << m_height << "\n255\n";
-    file.write(reinterpret_cast<const char*>(m_data), m_width * m_height);
+    for (unsigned int y = 0; y < m_height; ++y) {
+        file.write(reinterpret_cast<const char*>(row(y)), m_width);
+    }
 
     return true;
 }
 
-// Assignment operator - deep copy of another image
-// Handles self-assignment and memory management
-Image& Image::operator=(const Image &other) {
-    if (this != &other) {
-        delete[] m_data;
-        m_width = other.m_width;
-        m_height = other.m_height;
-        m_data = new unsigned char[m_width * m_height];
-        memcpy(m_data, other.m_data, m_width * m_height);
+#ifdef IMAGE_POSIX_IO
+
+// Map the whole file and adopt the pixel payload in place: the stride is
+// the width since PGM rows are packed, and the deleter unmaps the file.
+// Pages are only read when first touched.
+bool Image::loadMapped(const std::string& filename, MapMode mode) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        std::cerr << "Not a PGM file" << std::endl;
+        close(fd);
+        return false;
     }
-    return *this;
-}
 
-// Image addition - pixel by pixel addition with clamping to 255
-// Used for combining images or adding brightness
-Image Image::operator+(const Image &i) {
-    if (m_width != i.m_width || m_height != i.m_height)
-        throw std::runtime_error("Image dimensions must match");
+    const size_t size = static_cast<size_t>(info.st_size);
+    const int protection = mode == MapMode::ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+    void* mapping = mmap(nullptr, size, protection, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error mapping file: " << filename << std::endl;
+        return false;
+    }
 
-    Image result(m_width, m_height);
-    for (unsigned int y = 0; y < m_height; ++y) {
-        for (unsigned int x = 0; x < m_width; ++x) {
-            result.m_data[y * m_width + x] = std::min(255, 
-                static_cast<int>(m_data[y * m_width + x]) + static_cast<int>(i.m_data[y * m_width + x]));
-        }
+    unsigned char* bytes = static_cast<unsigned char*>(mapping);
+    unsigned int width, height;
+    size_t offset;
+    if (!parsePgmHeader(bytes, size, width, height, offset) ||
+        static_cast<unsigned long long>(width) * height > size - offset) {
+        std::cerr << "Not a PGM file" << std::endl;
+        munmap(mapping, size);
+        return false;
     }
-    return result;
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    *this = Image(bytes + offset, width, height, width, [mapping, size](unsigned char*) { munmap(mapping, size); });
+    return true;
 }
 
-// Image subtraction - pixel by pixel subtraction with clamping to 0
-// Used for difference images or subtracting brightness
-Image Image::operator-(const Image &i) {
-    if (m_width != i.m_width || m_height != i.m_height)
-        throw std::runtime_error("Image dimensions must match");
+// Same layout as save(). The file is truncated and allocated at its final
+// size first; rows of a packed image go out in large blocks, padded rows
+// one by one.
+bool Image::savePreallocated(const std::string& filename) const {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error opening file for writing: " << filename << std::endl;
+        return false;
+    }
 
-    Image result(m_width, m_height);
-    for (unsigned int y = 0; y < m_height; ++y) {
-        for (unsigned int x = 0; x < m_width; ++x) {
-            result.m_data[y * m_width + x] = std::max(0, 
-                static_cast<int>(m_data[y * m_width + x]) - static_cast<int>(i.m_data[y * m_width + x]));
+    std::ostringstream header;
+    header << "P5\n" << m_width << " " << m_height << "\n255\n";
+    const std::string headerText = header.str();
+    const off_t payloadOffset = static_cast<off_t>(headerText.size());
+    const off_t fileSize = payloadOffset + static_cast<off_t>(m_width) * m_height;
+
+    bool ok;
+#ifdef __linux__
+    // posix_fallocate reports its error directly, and glibc already emulates
+    // it where the file system lacks it; only when it is not supported at
+    // all does the file get its size through ftruncate, sparse. Any other
+    // error, a full disk above all, fails the save here.
+    const int allocated = posix_fallocate(fd, 0, fileSize);
+    ok = allocated == 0 || ((allocated == EOPNOTSUPP || allocated == EINVAL) && ftruncate(fd, fileSize) == 0);
+#else
+    ok = ftruncate(fd, fileSize) == 0;
+#endif
+    ok = ok && writeAt(fd, reinterpret_cast<const unsigned char*>(headerText.data()), headerText.size(), 0);
+
+    if (m_stride == m_width) {
+        const size_t block = size_t(64) << 20;
+        const size_t total = static_cast<size_t>(m_width) * m_height;
+        for (size_t done = 0; ok && done < total; done += block) {
+            ok = writeAt(fd, m_data + done, std::min(block, total - done), payloadOffset + static_cast<off_t>(done));
+        }
+    } else {
+        for (unsigned int y = 0; ok && y < m_height; ++y) {
+            ok = writeAt(fd, row(y), m_width, payloadOffset + static_cast<off_t>(y) * m_width);
         }
     }
-    return result;
+
+    if (close(fd) != 0 || !ok) {
+        std::cerr << "Error writing file: " << filename << std::endl;
+        unlink(filename.c_str()); // no truncated PGM left behind
+        return false;
+    }
+    return true;
 }
 
-// Image multiplication - pixel by pixel multiplication with scaling
-// Used for blending images or applying masks
-Image Image::operator*(const Image &i) {
-    if (m_width != i.m_width || m_height != i.m_height)
-        throw std::runtime_error("Image dimensions must match");
+#else
 
-    Image result(m_width, m_height);
-    for (unsigned int y = 0; y < m_height; ++y) {
-        for (unsigned int x = 0; x < m_width; ++x) {
-            result.m_data[y * m_width + x] = std::min(255, 
-                static_cast<int>(m_data[y * m_width + x]) * static_cast<int>(i.m_data[y * m_width + x]) / 255);
-        }
-    }
-    return result;
+bool Image::loadMapped(const std::string& filename, MapMode) {
+    return load(filename);
 }
 
-// Scalar addition - add constant value to all pixels
-// Used for uniform brightness adjustment
-Image Image::operator+(unsigned char scalar) {
-    Image result(m_width, m_height);
-    for (unsigned int y = 0; y < m_height; ++y) {
-        for (unsigned int x = 0; x < m_width; ++x) {
-            result.m_data[y * m_width + x] = std::min(255, 
-                static_cast<int>(m_data[y * m_width + x]) + static_cast<int>(scalar));
-        }
-    }
-    return result;
+bool Image::savePreallocated(const std::string& filename) const {
+    return save(filename);
 }
 
-// Scalar subtraction - subtract constant value from all pixels
-// Used for uniform darkness adjustment
-Image Image::operator-(unsigned char scalar) {
-    Image result(m_width, m_height);
-    for (unsigned int y = 0; y < m_height; ++y) {
-        for (unsigned int x = 0; x < m_width; ++x) {
-            result.m_data[y * m_width + x] = std::max(0, 
-                static_cast<int>(m_data[y * m_width + x]) - static_cast<int>(scalar));
-        }
+#endif // IMAGE_POSIX_IO
+
+// Assignment operator - deep copy of another image
+// Handles self-assignment; the old buffer is handed to its deleter, or left alone if borrowed
+Image& Image::operator=(const Image &other) {
+    if (this != &other) {
+        allocate(other.m_width, other.m_height, other.m_paddingRight, other.m_paddingBottom);
+        copyPixels(other);
     }
-    return result;
+    return *this;
 }
 
-// Scalar multiplication - multiply all pixels by constant
-// Used for uniform contrast adjustment
-Image Image::operator*(float scalar) {
-    Image result(m_width, m_height);
-    for (unsigned int y = 0; y < m_height; ++y) {
-        for (unsigned int x = 0; x < m_width; ++x) {
-            result.m_data[y * m_width + x] = std::min(255, 
-                static_cast<int>(m_data[y * m_width + x] * scalar));
-        }
+// Move assignment - takes over the buffer of other
+// The old buffer ends up in other and is freed with it
+Image& Image::operator=(Image &&other) noexcept {
+    if (this != &other) {
+        Image old(std::move(other));
+        swap(old);
     }
-    return result;
+    return *this;
 }
 
 // Get Region of Interest (ROI) using Rectangle
@@ -201,19 +421,28 @@ bool Image::getROI(Image &roiImg, unsigned int x, unsigned int y,
         return false;
 
     // Create new image for ROI
-    roiImg.release();
-    roiImg.m_width = width;
-    roiImg.m_height = height;
-    roiImg.m_data = new unsigned char[width * height];
+    roiImg.allocate(width, height, roiImg.m_paddingRight, roiImg.m_paddingBottom);
     
     // Copy ROI data
     for (unsigned int i = 0; i < height; ++i) {
-        std::copy(m_data + (y + i) * m_width + x, m_data + (y + i) * m_width + x + width, roiImg.m_data + i * width);
+        const unsigned char* src = m_data + static_cast<size_t>(y + i) * m_stride + x;
+        std::copy(src, src + width, roiImg.m_data + static_cast<size_t>(i) * roiImg.m_stride);
     }
     
     return true;
 }
 
+// Get Region of Interest (ROI) as a view sharing this image's pixels
+// The view keeps the image stride, only the start pointer moves
+ImageView Image::getROI(Rectangle roiRect) {
+    return ImageView(*this).subView(roiRect);
+}
+
+// Get Region of Interest (ROI) as a read-only view sharing this image's pixels
+ConstImageView Image::getROI(Rectangle roiRect) const {
+    return ConstImageView(*this).subView(roiRect);
+}
+
 // Check if image is empty (no data or zero dimensions)
 bool Image::isEmpty() const {
     return m_data == nullptr || m_width == 0 || m_height == 0;
@@ -234,12 +463,32 @@ unsigned int Image::height() const {
     return m_height;
 }
 
+// Get distance between row starts in bytes
+unsigned int Image::stride() const {
+    return m_stride;
+}
+
+// Get number of padding rows after the last row
+unsigned int Image::paddingBottom() const {
+    return m_paddingBottom;
+}
+
+// Get pointer to the first pixel
+unsigned char* Image::data() {
+    return m_data;
+}
+
+// Get pointer to the first pixel (const version)
+const unsigned char* Image::data() const {
+    return m_data;
+}
+
 // Get reference to pixel at (x,y) with bounds checking
 // Allows modifying the pixel value
 unsigned char& Image::at(unsigned int x, unsigned int y) {
     if (x >= m_width || y >= m_height)
         throw std::out_of_range("Index out of bounds");
-    return m_data[y * m_width + x];
+    return m_data[static_cast<size_t>(y) * m_stride + x];
 }
 
 // Get reference to pixel at Point with bounds checking
@@ -253,7 +502,7 @@ unsigned char& Image::at(Point pt) {
 const unsigned char& Image::at(unsigned int x, unsigned int y) const {
     if (x >= m_width || y >= m_height)
         throw std::out_of_range("Index out of bounds");
-    return m_data[y * m_width + x];
+    return m_data[static_cast<size_t>(y) * m_stride + x];
 }
 
 // Get pixel value at Point with bounds checking (const version)
@@ -262,20 +511,12 @@ const unsigned char& Image::at(Point pt) const {
     return at(pt.x, pt.y);
 }
 
-// Get pointer to start of row y
-// Useful for efficient row-by-row processing
-unsigned char* Image::row(int y) {
-    if (y < 0 || static_cast<unsigned int>(y) >= m_height)
-        throw std::out_of_range("Row index out of bounds");
-    return m_data + y * m_width;
-}
-
 // Output operator - print image as ASCII values
 // Useful for debugging small images
 std::ostream& operator<<(std::ostream& os, const Image& img) {
     for (unsigned int y = 0; y < img.m_height; ++y) {
         for (unsigned int x = 0; x < img.m_width; ++x) {
-            os << static_cast<int>(img.m_data[y * img.m_width + x]) << " ";
+            os << static_cast<int>(img.m_data[static_cast<size_t>(y) * img.m_stride + x]) << " ";
         }
         os << "\n";
     }
@@ -285,22 +526,39 @@ std::ostream& operator<<(std::ostream& os, const Image& img) {
 // Create black image (all pixels = 0)
 // Useful for creating masks or blank images
 Image Image::zeros(unsigned int width, unsigned int height) {
-    Image result(width, height);
-    memset(result.m_data, 0, width * height);
-    return result;
+    return Image(width, height);
 }
 
 // Create white image (all pixels = 255)
 // Useful for creating masks or blank images
 Image Image::ones(unsigned int width, unsigned int height) {
     Image result(width, height);
-    memset(result.m_data, 255, width * height);
+    for (unsigned char* r : result.rows()) {
+        memset(r, 255, width);
+    }
     return result;
 }
 
 void Image::release() {
-    delete[] m_data;
-    m_data = nullptr;
+    freeData();
     m_width = 0;
     m_height = 0;
+    m_stride = 0;
+}
+
+// Give the buffer back along with its deleter and leave the image empty
+Image::Buffer Image::detach() {
+    std::function<void(unsigned char*)> deleter;
+    deleter.swap(m_deleter);
+    if (!deleter)
+        deleter = [](unsigned char*) {};
+    Buffer buffer(m_data, std::move(deleter));
+    m_data = nullptr;
+    release();
+    return buffer;
+}
+
+// Check if the image frees its buffer
+bool Image::ownsData() const {
+    return static_cast<bool>(m_deleter);
 } 
\ No newline at end of file
@@ -1,15 +1,26 @@
 #pragma once
 
 #include <string>
+#include <functional>
+#include <memory>
 #include <iostream>
 #include "Point.h"
 #include "Size.h"
 #include "Rectangle.h"
+#include "ImageView.h"
 
 using namespace std;
 
+template <typename E>
+class ImageExpr;
+
 class Image {
 public:
+    /**
+     * @brief Pixel buffer handed out by detach(), freed by the deleter of the image
+     */
+    using Buffer = std::unique_ptr<unsigned char[], std::function<void(unsigned char*)>>;
+
     /**
      * @brief Default constructor
      */
@@ -17,10 +28,28 @@ public:
 
     /**
      * @brief Constructor with specified dimensions
+     * Rows start on kRowAlignment byte boundaries; the padding lets kernels
+     * read past the last column or row without bounds checks
+     * @param w Width of the image
+     * @param h Height of the image
+     * @param paddingRight Minimum number of extra bytes after each row
+     * @param paddingBottom Number of extra rows after the last row
+     */
+    Image(unsigned int w, unsigned int h, unsigned int paddingRight = 0, unsigned int paddingBottom = 0);
+
+    /**
+     * @brief Constructor over caller-provided memory, no pixels are copied
+     * Rows need not be aligned. When a deleter is given the image owns the
+     * memory and calls the deleter instead of freeing it; without one the
+     * memory is borrowed and must outlive the image.
+     * @param data Pointer to the first pixel
      * @param w Width of the image
      * @param h Height of the image
+     * @param stride Distance in bytes between the starts of two rows (stride >= w)
+     * @param deleter Called with data when the image lets go of the memory
      */
-    Image(unsigned int w, unsigned int h);
+    Image(unsigned char* data, unsigned int w, unsigned int h, unsigned int stride,
+          std::function<void(unsigned char*)> deleter = nullptr);
 
     /**
      * @brief Copy constructor
@@ -28,6 +57,12 @@ public:
      */
     Image(const Image &other);
 
+    /**
+     * @brief Move constructor, takes over the buffer of other and leaves it empty
+     * @param other Image to move from
+     */
+    Image(Image &&other) noexcept;
+
     /**
      * @brief Destructor
      */
@@ -48,53 +83,69 @@ public:
     bool save(const std::string& imagePath) const;
 
     /**
-     * @brief Assignment operator
-     * @param other Image to assign from
-     * @return Reference to this image
+     * @brief How a memory-mapped image may be written to
      */
-    Image& operator=(const Image &other);
+    enum class MapMode {
+        ReadOnly,   // writing a pixel crashes; the cheapest mode for pipelines that only read
+        CopyOnWrite // written pages get private copies, the file is never changed
+    };
 
     /**
-     * @brief Addition operator for two images
-     * @param i Image to add
-     * @return Resulting image
+     * @brief Load a PGM file by mapping it into memory
+     * The pixels are used in place inside the mapping, with a stride of
+     * the width: nothing is read until a row is first touched, so a
+     * processor can start on a huge file right away, and the page cache
+     * is the only copy of the pixels. The mapping is released with the
+     * image. POSIX only; elsewhere this falls back to load().
+     * @param imagePath Path to the image file
+     * @param mode Whether the pixels may be written to
+     * @return true if loading was successful, false otherwise
      */
-    Image operator+(const Image &i);
+    bool loadMapped(const std::string& imagePath, MapMode mode = MapMode::ReadOnly);
 
     /**
-     * @brief Subtraction operator for two images
-     * @param i Image to subtract
-     * @return Resulting image
+     * @brief Save image to file with positioned writes into a preallocated file
+     * The file gets its final size before any pixel is written, so the
+     * file system can lay it out in one piece and a full disk fails early,
+     * and rows go out with pwrite instead of through a stream buffer.
+     * A failed save removes the partial file.
+     * POSIX only; elsewhere this falls back to save().
+     * @param imagePath Path where to save the image
+     * @return true if saving was successful, false otherwise
      */
-    Image operator-(const Image &i);
+    bool savePreallocated(const std::string& imagePath) const;
 
     /**
-     * @brief Multiplication operator for two images
-     * @param i Image to multiply with
-     * @return Resulting image
+     * @brief Assignment operator
+     * @param other Image to assign from
+     * @return Reference to this image
      */
-    Image operator*(const Image &i);
+    Image& operator=(const Image &other);
 
     /**
-     * @brief Addition operator for image and scalar
-     * @param scalar Value to add
-     * @return Resulting image
+     * @brief Move assignment operator, takes over the buffer of other
+     * @param other Image to move from, left empty
+     * @return Reference to this image
      */
-    Image operator+(unsigned char scalar);
+    Image& operator=(Image &&other) noexcept;
 
     /**
-     * @brief Subtraction operator for image and scalar
-     * @param scalar Value to subtract
-     * @return Resulting image
+     * @brief Constructor that evaluates an arithmetic expression
+     * Lets Image r = a + b; evaluate the whole expression in one pass,
+     * see ImageExpression.h
+     * @param expr Expression to evaluate
      */
-    Image operator-(unsigned char scalar);
+    template <typename E>
+    Image(const ImageExpr<E>& expr);
 
     /**
-     * @brief Multiplication operator for image and scalar
-     * @param scalar Value to multiply with
-     * @return Resulting image
+     * @brief Assignment of an arithmetic expression
+     * The current buffer is reused when it has the size of the result
+     * @param expr Expression to evaluate
+     * @return Reference to this image
      */
-    Image operator*(float scalar);
+    template <typename E>
+    Image& operator=(const ImageExpr<E>& expr);
 
     /**
      * @brief Get region of interest from image
@@ -116,6 +167,22 @@ public:
     bool getROI(Image &roiImg, unsigned int x, unsigned int y, 
                 unsigned int width, unsigned int height);
 
+    /**
+     * @brief Get region of interest as a view, without copying pixels
+     * Writes through the view change this image; the view is invalidated
+     * when the image is reallocated or released
+     * @param roiRect Rectangle defining the region of interest
+     * @return View of the ROI, empty if the ROI is outside image bounds
+     */
+    ImageView getROI(Rectangle roiRect);
+
+    /**
+     * @brief Get region of interest as a read-only view, without copying pixels
+     * @param roiRect Rectangle defining the region of interest
+     * @return View of the ROI, empty if the ROI is outside image bounds
+     */
+    ConstImageView getROI(Rectangle roiRect) const;
+
     /**
      * @brief Check if image is empty
      * @return true if image is empty, false otherwise
@@ -140,6 +207,30 @@ public:
      */
     unsigned int height() const;
 
+    /**
+     * @brief Get distance in bytes between the starts of two consecutive rows
+     * @return Row stride, a multiple of kRowAlignment unless the memory was provided by the caller
+     */
+    unsigned int stride() const;
+
+    /**
+     * @brief Get number of padding rows after the last row
+     * @return Bottom padding in rows
+     */
+    unsigned int paddingBottom() const;
+
+    /**
+     * @brief Get pointer to the first pixel, rows follow each other every stride() bytes
+     * @return Pointer to pixel data
+     */
+    unsigned char* data();
+
+    /**
+     * @brief Get pointer to the first pixel (const version)
+     * @return Pointer to pixel data
+     */
+    const unsigned char* data() const;
+
     /**
      * @brief Access pixel value at specified coordinates
      * @param x X coordinate
@@ -171,17 +262,67 @@ public:
     const unsigned char& at(Point pt) const;
 
     /**
-     * @brief Get pointer to row data
+     * @brief Get pointer to row data, checked only with IMAGE_BOUNDS_CHECK
      * @param y Row index
      * @return Pointer to row data
      */
     unsigned char* row(int y);
 
+    /**
+     * @brief Get pointer to row data, checked only with IMAGE_BOUNDS_CHECK (const version)
+     * @param y Row index
+     * @return Pointer to row data
+     */
+    const unsigned char* row(int y) const;
+
+    /**
+     * @brief Get pointer to a pixel, checked only with IMAGE_BOUNDS_CHECK
+     * @param x X coordinate
+     * @param y Y coordinate
+     * @return Pointer to the pixel
+     */
+    unsigned char* ptr(unsigned int x, unsigned int y);
+
+    /**
+     * @brief Get pointer to a pixel, checked only with IMAGE_BOUNDS_CHECK (const version)
+     * @param x X coordinate
+     * @param y Y coordinate
+     * @return Pointer to the pixel
+     */
+    const unsigned char* ptr(unsigned int x, unsigned int y) const;
+
+    /**
+     * @brief Get a range over the rows
+     * @return Range yielding a pointer to each row
+     */
+    RowRange<unsigned char> rows();
+
+    /**
+     * @brief Get a range over the rows (const version)
+     * @return Range yielding a pointer to each row
+     */
+    RowRange<const unsigned char> rows() const;
+
     /**
      * @brief Release image data
      */
     void release();
 
+    /**
+     * @brief Hand the pixel buffer over to the caller without freeing it
+     * The image is left empty. The buffer keeps the deleter the image would
+     * have called, whether the image allocated it, mapped it or was given
+     * one; a borrowed buffer gets a deleter that does nothing.
+     * @return Owner of the first pixel, empty if the image was empty
+     */
+    Buffer detach();
+
+    /**
+     * @brief Check if the image frees its buffer
+     * @return true if the buffer is freed by the image, false if it is borrowed
+     */
+    bool ownsData() const;
+
     /**
      * @brief Stream output operator
      * @param os Output stream
@@ -206,8 +347,71 @@ public:
      */
     static Image ones(unsigned int width, unsigned int height);
 
+    /**
+     * @brief Alignment in bytes of every row start
+     */
+    static const unsigned int kRowAlignment = 64;
+
 private:
+    /**
+     * @brief Replace the pixel buffer with a new zero-filled one
+     */
+    void allocate(unsigned int width, unsigned int height, unsigned int paddingRight, unsigned int paddingBottom);
+
+    /**
+     * @brief Copy pixels row by row from an image of the same size
+     */
+    void copyPixels(const Image& other);
+
+    /**
+     * @brief Exchange buffers and layouts with another image
+     */
+    void swap(Image& other) noexcept;
+
+    /**
+     * @brief Let go of the pixel buffer, calling the deleter if there is one
+     */
+    void freeData();
+
     unsigned char* m_data;
     unsigned int m_width;
     unsigned int m_height;
-}; 
\ No newline at end of file
+    unsigned int m_stride;
+    unsigned int m_paddingRight;
+    unsigned int m_paddingBottom;
+    std::function<void(unsigned char*)> m_deleter; // empty when the buffer is borrowed
+};
+
+// The unchecked accessors are defined here so that they inline into the
+// processing loops
+
+inline unsigned char* Image::row(int y) {
+    checkPixelIndex(0, static_cast<unsigned int>(y), m_width, m_height);
+    return m_data + static_cast<size_t>(y) * m_stride;
+}
+
+inline const unsigned char* Image::row(int y) const {
+    checkPixelIndex(0, static_cast<unsigned int>(y), m_width, m_height);
+    return m_data + static_cast<size_t>(y) * m_stride;
+}
+
+inline unsigned char* Image::ptr(unsigned int x, unsigned int y) {
+    checkPixelIndex(x, y, m_width, m_height);
+    return m_data + static_cast<size_t>(y) * m_stride + x;
+}
+
+inline const unsigned char* Image::ptr(unsigned int x, unsigned int y) const {
+    checkPixelIndex(x, y, m_width, m_height);
+    return m_data + static_cast<size_t>(y) * m_stride + x;
+}
+
+inline RowRange<unsigned char> Image::rows() {
+    return RowRange<unsigned char>(m_data, m_width, m_height, m_stride);
+}
+
+inline RowRange<const unsigned char> Image::rows() const {
+    return RowRange<const unsigned char>(m_data, m_width, m_height, m_stride);
+}
+
+// The arithmetic operators build lazy expressions
+#include "ImageExpression.h"
@@ -0,0 +1,309 @@
+#ifndef IMAGE_EXPRESSION_H
+#define IMAGE_EXPRESSION_H
+
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "Image.h"
+#include "SimdArithmetic.h"
+
+/**
+ * @brief Lazy Image arithmetic
+ *
+ * The arithmetic operators on images build an expression tree instead of an
+ * image. Converting the tree to an Image, or assigning it to one, evaluates
+ * it in a single pass over the pixels, with no intermediate images. Each
+ * operation still saturates to [0, 255] like the eager version did.
+ *
+ * Nodes hold references to the images they read, so an expression must be
+ * turned into an Image before the end of the full statement that built it;
+ * do not keep one in an auto variable.
+ */
+
+/**
+ * @brief Base of every expression node (CRTP)
+ */
+template <typename E>
+class ImageExpr {
+public:
+    const E& self() const { return static_cast<const E&>(*this); }
+};
+
+/**
+ * @brief Leaf node reading an image
+ */
+class ImageTerm : public ImageExpr<ImageTerm> {
+public:
+    struct Row {
+        const unsigned char* pixels;
+        unsigned char operator[](unsigned int x) const { return pixels[x]; }
+    };
+
+    explicit ImageTerm(const Image& image) : m_image(image) {}
+
+    unsigned int width() const { return m_image.width(); }
+    unsigned int height() const { return m_image.height(); }
+    Row row(unsigned int y) const { return Row{m_image.row(y)}; }
+    const Image& image() const { return m_image; }
+
+private:
+    const Image& m_image;
+};
+
+/**
+ * @brief Node combining two same-sized operands pixel by pixel
+ */
+template <typename Op, typename L, typename R>
+class BinaryExpr : public ImageExpr<BinaryExpr<Op, L, R>> {
+public:
+    struct Row {
+        typename L::Row left;
+        typename R::Row right;
+        unsigned char operator[](unsigned int x) const { return Op::apply(left[x], right[x]); }
+    };
+
+    BinaryExpr(const L& left, const R& right) : m_left(left), m_right(right) {
+        if (left.width() != right.width() || left.height() != right.height())
+            throw std::runtime_error("Image dimensions must match");
+    }
+
+    unsigned int width() const { return m_left.width(); }
+    unsigned int height() const { return m_left.height(); }
+    Row row(unsigned int y) const { return Row{m_left.row(y), m_right.row(y)}; }
+    const L& left() const { return m_left; }
+    const R& right() const { return m_right; }
+
+private:
+    L m_left;
+    R m_right;
+};
+
+/**
+ * @brief Node combining an operand with a constant
+ */
+template <typename Op, typename E, typename S>
+class ScalarExpr : public ImageExpr<ScalarExpr<Op, E, S>> {
+public:
+    struct Row {
+        typename E::Row operand;
+        S scalar;
+        unsigned char operator[](unsigned int x) const { return Op::apply(operand[x], scalar); }
+    };
+
+    ScalarExpr(const E& operand, S scalar) : m_operand(operand), m_scalar(scalar) {}
+
+    unsigned int width() const { return m_operand.width(); }
+    unsigned int height() const { return m_operand.height(); }
+    Row row(unsigned int y) const { return Row{m_operand.row(y), m_scalar}; }
+    const E& operand() const { return m_operand; }
+    S scalar() const { return m_scalar; }
+
+private:
+    E m_operand;
+    S m_scalar;
+};
+
+// Per-pixel operations, the same arithmetic as the scalar SimdArithmetic kernels
+
+struct AddOp {
+    static unsigned char apply(unsigned char a, unsigned char b) {
+        return static_cast<unsigned char>(std::min(255, static_cast<int>(a) + static_cast<int>(b)));
+    }
+};
+
+struct SubtractOp {
+    static unsigned char apply(unsigned char a, unsigned char b) {
+        return static_cast<unsigned char>(std::max(0, static_cast<int>(a) - static_cast<int>(b)));
+    }
+};
+
+struct MultiplyOp {
+    static unsigned char apply(unsigned char a, unsigned char b) {
+        return static_cast<unsigned char>(static_cast<int>(a) * static_cast<int>(b) / 255);
+    }
+};
+
+struct MultiplyScalarOp {
+    static unsigned char apply(unsigned char a, float scalar) {
+        return static_cast<unsigned char>(std::min(255, static_cast<int>(a * scalar)));
+    }
+};
+
+/**
+ * @brief Multiplication by a constant, through a table of the 256 products
+ * The table is built once with the node; evaluation only looks pixels up.
+ */
+template <typename E>
+class ScalarExpr<MultiplyScalarOp, E, float> : public ImageExpr<ScalarExpr<MultiplyScalarOp, E, float>> {
+public:
+    struct Row {
+        typename E::Row operand;
+        const unsigned char* table;
+        unsigned char operator[](unsigned int x) const { return table[operand[x]]; }
+    };
+
+    ScalarExpr(const E& operand, float scalar) : m_operand(operand), m_scalar(scalar) {
+        for (int value = 0; value < 256; ++value) {
+            m_table[value] = MultiplyScalarOp::apply(static_cast<unsigned char>(value), scalar);
+        }
+    }
+
+    unsigned int width() const { return m_operand.width(); }
+    unsigned int height() const { return m_operand.height(); }
+    Row row(unsigned int y) const { return Row{m_operand.row(y), m_table}; }
+    const E& operand() const { return m_operand; }
+    float scalar() const { return m_scalar; }
+    const unsigned char* table() const { return m_table; }
+
+private:
+    E m_operand;
+    float m_scalar;
+    unsigned char m_table[256];
+};
+
+// Operands: images and expression nodes
+
+template <typename T>
+struct IsImageOperand
+    : std::integral_constant<bool, std::is_same<T, Image>::value || std::is_base_of<ImageExpr<T>, T>::value> {};
+
+inline ImageTerm toExpr(const Image& image) { return ImageTerm(image); }
+
+template <typename E>
+const E& toExpr(const ImageExpr<E>& expr) { return expr.self(); }
+
+template <typename T>
+using ExprOf = typename std::decay<decltype(toExpr(std::declval<const T&>()))>::type;
+
+template <typename L, typename R>
+using EnableIfImageOperands = typename std::enable_if<IsImageOperand<L>::value && IsImageOperand<R>::value>::type;
+
+template <typename T>
+using EnableIfImageOperand = typename std::enable_if<IsImageOperand<T>::value>::type;
+
+/**
+ * @brief Addition of two images, clamped to 255
+ */
+template <typename L, typename R, typename = EnableIfImageOperands<L, R>>
+BinaryExpr<AddOp, ExprOf<L>, ExprOf<R>> operator+(const L& left, const R& right) {
+    return BinaryExpr<AddOp, ExprOf<L>, ExprOf<R>>(toExpr(left), toExpr(right));
+}
+
+/**
+ * @brief Subtraction of two images, clamped to 0
+ */
+template <typename L, typename R, typename = EnableIfImageOperands<L, R>>
+BinaryExpr<SubtractOp, ExprOf<L>, ExprOf<R>> operator-(const L& left, const R& right) {
+    return BinaryExpr<SubtractOp, ExprOf<L>, ExprOf<R>>(toExpr(left), toExpr(right));
+}
+
+/**
+ * @brief Multiplication of two images, a * b / 255
+ */
+template <typename L, typename R, typename = EnableIfImageOperands<L, R>>
+BinaryExpr<MultiplyOp, ExprOf<L>, ExprOf<R>> operator*(const L& left, const R& right) {
+    return BinaryExpr<MultiplyOp, ExprOf<L>, ExprOf<R>>(toExpr(left), toExpr(right));
+}
+
+/**
+ * @brief Addition of a constant, clamped to 255
+ */
+template <typename T, typename = EnableIfImageOperand<T>>
+ScalarExpr<AddOp, ExprOf<T>, unsigned char> operator+(const T& operand, unsigned char scalar) {
+    return ScalarExpr<AddOp, ExprOf<T>, unsigned char>(toExpr(operand), scalar);
+}
+
+/**
+ * @brief Subtraction of a constant, clamped to 0
+ */
+template <typename T, typename = EnableIfImageOperand<T>>
+ScalarExpr<SubtractOp, ExprOf<T>, unsigned char> operator-(const T& operand, unsigned char scalar) {
+    return ScalarExpr<SubtractOp, ExprOf<T>, unsigned char>(toExpr(operand), scalar);
+}
+
+/**
+ * @brief Multiplication by a constant, clamped to 255
+ */
+template <typename T, typename = EnableIfImageOperand<T>>
+ScalarExpr<MultiplyScalarOp, ExprOf<T>, float> operator*(const T& operand, float scalar) {
+    return ScalarExpr<MultiplyScalarOp, ExprOf<T>, float>(toExpr(operand), scalar);
+}
+
+// Evaluation, one row at a time. A single operation on images runs the SIMD
+// row kernel, the table lookup for a multiplication by a constant; any other
+// tree is evaluated pixel by pixel in one loop, which the compiler can
+// vectorize since every node inlines.
+
+template <typename E>
+void evaluateRow(const E& expr, unsigned int y, unsigned char* dst, const SimdArithmetic::Kernels&) {
+    typename E::Row row = expr.row(y);
+    const unsigned int width = expr.width();
+    for (unsigned int x = 0; x < width; ++x) {
+        dst[x] = row[x];
+    }
+}
+
+inline void evaluateRow(const BinaryExpr<AddOp, ImageTerm, ImageTerm>& expr, unsigned int y,
+                        unsigned char* dst, const SimdArithmetic::Kernels& kernels) {
+    kernels.add(expr.left().image().row(y), expr.right().image().row(y), dst, expr.width());
+}
+
+inline void evaluateRow(const BinaryExpr<SubtractOp, ImageTerm, ImageTerm>& expr, unsigned int y,
+                        unsigned char* dst, const SimdArithmetic::Kernels& kernels) {
+    kernels.subtract(expr.left().image().row(y), expr.right().image().row(y), dst, expr.width());
+}
+
+inline void evaluateRow(const BinaryExpr<MultiplyOp, ImageTerm, ImageTerm>& expr, unsigned int y,
+                        unsigned char* dst, const SimdArithmetic::Kernels& kernels) {
+    kernels.multiply(expr.left().image().row(y), expr.right().image().row(y), dst, expr.width());
+}
+
+inline void evaluateRow(const ScalarExpr<AddOp, ImageTerm, unsigned char>& expr, unsigned int y,
+                        unsigned char* dst, const SimdArithmetic::Kernels& kernels) {
+    kernels.addScalar(expr.operand().image().row(y), expr.scalar(), dst, expr.width());
+}
+
+inline void evaluateRow(const ScalarExpr<SubtractOp, ImageTerm, unsigned char>& expr, unsigned int y,
+                        unsigned char* dst, const SimdArithmetic::Kernels& kernels) {
+    kernels.subtractScalar(expr.operand().image().row(y), expr.scalar(), dst, expr.width());
+}
+
+inline void evaluateRow(const ScalarExpr<MultiplyScalarOp, ImageTerm, float>& expr, unsigned int y,
+                        unsigned char* dst, const SimdArithmetic::Kernels& kernels) {
+    kernels.lookup(expr.operand().image().row(y), expr.table(), dst, expr.width());
+}
+
+/**
+ * @brief Evaluate an expression into an image of its size
+ * Every output pixel only reads the input pixels at the same position, so
+ * the destination may be one of the images the expression reads
+ */
+template <typename E>
+void evaluateInto(const E& expr, Image& dst) {
+    const SimdArithmetic::Kernels& kernels = SimdArithmetic::best();
+    for (unsigned int y = 0; y < expr.height(); ++y) {
+        evaluateRow(expr, y, dst.row(y), kernels);
+    }
+}
+
+template <typename E>
+Image::Image(const ImageExpr<E>& expr) : Image(expr.self().width(), expr.self().height()) {
+    evaluateInto(expr.self(), *this);
+}
+
+// A same-sized destination is written in place; otherwise the result is
+// built first so that a buffer the expression reads is not freed under it
+template <typename E>
+Image& Image::operator=(const ImageExpr<E>& expr) {
+    const E& e = expr.self();
+    if (isEmpty() || m_width != e.width() || m_height != e.height()) {
+        Image result(expr);
+        swap(result);
+    } else {
+        evaluateInto(e, *this);
+    }
+    return *this;
+}
+
+#endif // IMAGE_EXPRESSION_H
@@ -1,9 +1,146 @@
 #include "ImageProcessing.h"
+#include "Instrumentation.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 
 ImageProcessing::ImageProcessing() {}
 
 ImageProcessing::~ImageProcessing() {}
 
+// Point operations only read the pixel they write
+unsigned int ImageProcessing::halo() const {
+    return 0;
+}
+
+bool ImageProcessing::process(ConstImageView input, ImageView output) {
+#ifdef IMAGE_INSTRUMENTATION
+    Instrumentation::CallScope scope(Instrumentation::typeName(typeid(*this)),
+                                     static_cast<uint64_t>(output.width()) * output.height());
+#endif
+    return doProcess(input, output);
+}
+
+bool ImageProcessing::process(ConstImageView input, ImageView output, const Rectangle& roi) {
+#ifdef IMAGE_INSTRUMENTATION
+    Instrumentation::CallScope scope(Instrumentation::typeName(typeid(*this)),
+                                     static_cast<uint64_t>(roi.width) * roi.height);
+#endif
+    return doProcess(input, output, roi);
+}
+
+// Only reallocate when the size changes, so a loop over same-sized frames
+// keeps writing into the same buffer
 bool ImageProcessing::process(const Image& input, Image& output) {
-    return false;
-} 
\ No newline at end of file
+    if (input.isEmpty()) {
+        return false;
+    }
+    if (output.isEmpty() || output.width() != input.width() || output.height() != input.height()) {
+        output = Image(input.width(), input.height());
+    }
+    return process(ConstImageView(input), ImageView(output));
+}
+
+// Pixels of the grown region closer than halo() to an edge that is not an
+// image edge miss part of their neighbourhood, but none of them is in roi.
+// Where the grown region reaches the image edge it is clipped, so the
+// processor sees the same border as on the whole view.
+bool ImageProcessing::doProcess(ConstImageView input, ImageView output, const Rectangle& roi) {
+    if (input.isEmpty() || output.isEmpty()) {
+        return false;
+    }
+    if (output.width() != input.width() || output.height() != input.height()) {
+        return false;
+    }
+    if (!isInside(roi, input.width(), input.height())) {
+        return false;
+    }
+
+    const unsigned int margin = halo();
+    if (margin == 0) {
+        return doProcess(input.subView(roi), output.subView(roi));
+    }
+    if (margin == kUnboundedHalo) {
+        static thread_local Image wholeScratch;
+        ImageView whole = scratchView(wholeScratch, input.width(), input.height());
+        if (!doProcess(input, whole))
+            return false;
+        copyPixels(ConstImageView(whole).subView(roi), output.subView(roi));
+        return true;
+    }
+
+    const Rectangle region = grow(roi, margin, input.width(), input.height());
+    static thread_local Image scratch;
+    ImageView grown = scratchView(scratch, region.width, region.height);
+    if (!doProcess(input.subView(region), grown))
+        return false;
+    copyPixels(ConstImageView(grown).subView(Rectangle(roi.x - region.x, roi.y - region.y, roi.width, roi.height)),
+               output.subView(roi));
+    return true;
+}
+
+bool ImageProcessing::process(const Image& input, Image& output, const Rectangle& roi) {
+    if (input.isEmpty()) {
+        return false;
+    }
+    if (output.isEmpty() || output.width() != input.width() || output.height() != input.height()) {
+        output = Image(input.width(), input.height());
+    }
+    return process(ConstImageView(input), ImageView(output), roi);
+}
+
+bool ImageProcessing::isInside(const Rectangle& roi, unsigned int width, unsigned int height) {
+    return roi.width > 0 && roi.height > 0 &&
+           roi.x < width && roi.width <= width - roi.x &&
+           roi.y < height && roi.height <= height - roi.y;
+}
+
+Rectangle ImageProcessing::grow(const Rectangle& rect, unsigned int margin, unsigned int width, unsigned int height) {
+    unsigned int x0 = rect.x > margin ? rect.x - margin : 0;
+    unsigned int y0 = rect.y > margin ? rect.y - margin : 0;
+    unsigned int x1 = std::min(width, rect.x + rect.width + std::min(margin, width));
+    unsigned int y1 = std::min(height, rect.y + rect.height + std::min(margin, height));
+    return Rectangle(x0, y0, x1 - x0, y1 - y0);
+}
+
+void ImageProcessing::copyPixels(ConstImageView src, ImageView dst) {
+    for (unsigned int y = 0; y < src.height(); y++) {
+        memcpy(dst.row(y), src.row(y), src.width());
+    }
+}
+
+ImageView ImageProcessing::scratchView(Image& scratch, unsigned int width, unsigned int height) {
+    const uint64_t requested = static_cast<uint64_t>(width) * height;
+    const uint64_t held = static_cast<uint64_t>(scratch.width()) * scratch.height();
+    if (held > kScratchSlack * requested)
+        scratch = Image(width, height);
+    else if (scratch.width() < width || scratch.height() < height)
+        scratch = Image(std::max(scratch.width(), width), std::max(scratch.height(), height));
+    return ImageView(scratch).subView(Rectangle(0, 0, width, height));
+}
+
+// Reflect repeats with a period of 2 * (size - 1), so indices further out
+// than the image is wide still land inside it
+int ImageProcessing::borderIndex(int i, int size, BorderMode mode) {
+    if (i >= 0 && i < size) {
+        return i;
+    }
+    switch (mode) {
+    case BorderMode::Replicate:
+        return i < 0 ? 0 : size - 1;
+    case BorderMode::Reflect: {
+        if (size == 1)
+            return 0;
+        const int period = 2 * (size - 1);
+        i %= period;
+        if (i < 0)
+            i += period;
+        return i < size ? i : period - i;
+    }
+    case BorderMode::Wrap:
+        i %= size;
+        return i < 0 ? i + size : i;
+    default:
+        return -1;
+    }
+}
@@ -2,6 +2,29 @@
 #define IMAGE_PROCESSING_H
 
 #include "Image.h"
+#include "ImageView.h"
+
+/**
+ * @brief What neighbourhood filters read for pixels outside the image
+ */
+enum class BorderMode {
+    Zero,      // black, the default
+    Constant,  // a given value
+    Replicate, // the nearest edge pixel: aaa|abcd|ddd
+    Reflect,   // mirrored about the edge pixel, which is not repeated: cb|abcd|cb
+    Wrap       // the opposite side of the image: cd|abcd|ab
+};
+
+/**
+ * @brief Border mode with the value used by BorderMode::Constant
+ * Converts from a BorderMode, so a mode can be passed wherever a Border is expected.
+ */
+struct Border {
+    Border(BorderMode mode = BorderMode::Zero, unsigned char value = 0) : mode(mode), value(value) {}
+
+    BorderMode mode;
+    unsigned char value;
+};
 
 class ImageProcessing {
 public:
@@ -13,10 +36,105 @@ public:
 
     /**
      * @brief Process the image
+     * Images convert to views implicitly, so whole images can be passed as
+     * well as sub-images from Image::getROI. The output view must not
+     * overlap the input view. Runs doProcess, timed and counted when
+     * instrumentation is built in.
+     * @param input Source view
+     * @param output Destination view, must have the size of input
+     */
+    bool process(ConstImageView input, ImageView output);
+
+    /**
+     * @brief Process a whole image into an image
+     * The output buffer is reused when it already has the size of the input,
+     * otherwise it is replaced by a new one.
+     * @param input Source image
+     * @param output Destination image, resized if needed
+     */
+    bool process(const Image& input, Image& output);
+
+    /**
+     * @brief Process only a region of the output
+     * Only the output pixels inside roi are computed and written, from the
+     * input pixels inside roi grown by halo(); the result inside roi is the
+     * same as after processing the whole view.
+     * @param input Source view
+     * @param output Destination view, must have the size of input
+     * @param roi Region to compute, must lie inside input
+     */
+    bool process(ConstImageView input, ImageView output, const Rectangle& roi);
+
+    /**
+     * @brief Process a region of a whole image into an image
+     * The output is resized like in process(const Image&, Image&); its
+     * pixels outside roi are left as they are.
      * @param input Source image
-     * @param output Destination image
+     * @param output Destination image, resized if needed
+     * @param roi Region to compute, must lie inside input
+     */
+    bool process(const Image& input, Image& output, const Rectangle& roi);
+
+    /**
+     * @brief Number of pixels around an output pixel that its value depends on
+     * Pipeline uses it to size the overlap between tiles
+     * @return Halo in pixels, kUnboundedHalo if every pixel depends on the whole image
+     */
+    virtual unsigned int halo() const;
+
+    /**
+     * @brief Halo of processors whose output cannot be computed tile by tile
+     */
+    static const unsigned int kUnboundedHalo = ~0u;
+
+protected:
+    /**
+     * @brief Processing of the derived class, called by process
+     * @param input Source view
+     * @param output Destination view, must have the size of input
+     */
+    virtual bool doProcess(ConstImageView input, ImageView output) = 0;
+
+    /**
+     * @brief Region processing of the derived class, called by process
+     * The default implementation runs doProcess on roi grown by halo() and
+     * copies roi out of it.
+     * @param input Source view
+     * @param output Destination view, must have the size of input
+     * @param roi Region to compute, must lie inside input
+     */
+    virtual bool doProcess(ConstImageView input, ImageView output, const Rectangle& roi);
+
+    /**
+     * @brief Check that roi is a non-empty region of a width x height image
+     */
+    static bool isInside(const Rectangle& roi, unsigned int width, unsigned int height);
+
+    /**
+     * @brief Rectangle grown by margin on every side, clipped to a width x height image
+     */
+    static Rectangle grow(const Rectangle& rect, unsigned int margin, unsigned int width, unsigned int height);
+
+    /**
+     * @brief Copy the pixels of a view into a view of the same size
+     */
+    static void copyPixels(ConstImageView src, ImageView dst);
+
+    /**
+     * @brief Top-left width x height view of a scratch buffer, grown to fit
+     * A buffer holding more than kScratchSlack times the pixels asked for is
+     * reallocated to fit, so one large call does not pin its memory
+     */
+    static ImageView scratchView(Image& scratch, unsigned int width, unsigned int height);
+
+    static const unsigned int kScratchSlack = 4;
+
+    /**
+     * @brief Index of the pixel read for index i of a row or column of size pixels
+     * @return i itself inside [0, size), the pixel the border mode maps it
+     *         to outside, or -1 for Zero and Constant, which read no pixel
      */
-    virtual bool process(const Image& input, Image& output) = 0;
+    static int borderIndex(int i, int size, BorderMode mode);
 };
 
 #endif // IMAGE_PROCESSING_H 
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include "ImageView.h"
+#include "Image.h"
+#include <stdexcept>
+
+namespace {
+
+// Check that a rectangle lies inside a width x height area
+bool fits(const Rectangle& rect, unsigned int width, unsigned int height) {
+    return rect.x <= width && rect.width <= width - rect.x &&
+           rect.y <= height && rect.height <= height - rect.y;
+}
+
+} // namespace
+
+ConstImageView::ConstImageView(const Image& image)
+    : m_data(image.data()), m_width(image.width()), m_height(image.height()), m_stride(image.stride()) {}
+
+// The sub-view shares the stride, only the start pointer moves
+ConstImageView ConstImageView::subView(const Rectangle& rect) const {
+    if (!fits(rect, m_width, m_height))
+        return ConstImageView();
+    return ConstImageView(m_data + static_cast<size_t>(rect.y) * m_stride + rect.x, rect.width, rect.height, m_stride);
+}
+
+const unsigned char& ConstImageView::at(unsigned int x, unsigned int y) const {
+    if (x >= m_width || y >= m_height)
+        throw std::out_of_range("Index out of bounds");
+    return row(y)[x];
+}
+
+ImageView::ImageView(Image& image)
+    : m_data(image.data()), m_width(image.width()), m_height(image.height()), m_stride(image.stride()) {}
+
+ImageView ImageView::subView(const Rectangle& rect) const {
+    if (!fits(rect, m_width, m_height))
+        return ImageView();
+    return ImageView(m_data + static_cast<size_t>(rect.y) * m_stride + rect.x, rect.width, rect.height, m_stride);
+}
+
+unsigned char& ImageView::at(unsigned int x, unsigned int y) const {
+    if (x >= m_width || y >= m_height)
+        throw std::out_of_range("Index out of bounds");
+    return row(y)[x];
+}
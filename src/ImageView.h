@@ -0,0 +1,258 @@
+#ifndef IMAGE_VIEW_H
+#define IMAGE_VIEW_H
+
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include "Rectangle.h"
+#include "Size.h"
+
+class Image;
+
+/**
+ * @brief Index check of the unchecked accessors row() and ptr()
+ *
+ * Does nothing unless built with IMAGE_BOUNDS_CHECK, in which case an index
+ * outside the image throws std::out_of_range.
+ */
+inline void checkPixelIndex(unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+#ifdef IMAGE_BOUNDS_CHECK
+    if (x >= width || y >= height)
+        throw std::out_of_range("Index out of bounds");
+#else
+    (void)x; (void)y; (void)width; (void)height;
+#endif
+}
+
+/**
+ * @brief Range over the rows of an image or view, yielding a pointer per row
+ *
+ * for (unsigned char* row : image.rows()) walks the rows top to bottom.
+ */
+template <typename T>
+class RowRange {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T*;
+        using difference_type = std::ptrdiff_t;
+        using pointer = T**;
+        using reference = T*;
+
+        iterator(T* row, unsigned int stride) : m_row(row), m_stride(stride) {}
+        T* operator*() const { return m_row; }
+        iterator& operator++() { m_row += m_stride; return *this; }
+        iterator operator++(int) { iterator old = *this; m_row += m_stride; return old; }
+        bool operator==(const iterator& other) const { return m_row == other.m_row; }
+        bool operator!=(const iterator& other) const { return m_row != other.m_row; }
+
+    private:
+        T* m_row;
+        unsigned int m_stride;
+    };
+
+    RowRange(T* data, unsigned int width, unsigned int height, unsigned int stride)
+        : m_data(data), m_width(width), m_height(height), m_stride(stride) {}
+
+    iterator begin() const { return iterator(m_data, m_stride); }
+    iterator end() const { return iterator(m_data + static_cast<size_t>(m_height) * m_stride, m_stride); }
+
+    /**
+     * @brief Number of rows
+     */
+    unsigned int size() const { return m_height; }
+
+    /**
+     * @brief Number of pixels in each row
+     */
+    unsigned int width() const { return m_width; }
+
+    T* operator[](unsigned int y) const {
+        checkPixelIndex(0, y, m_width, m_height);
+        return m_data + static_cast<size_t>(y) * m_stride;
+    }
+
+private:
+    T* m_data;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_stride;
+};
+
+/**
+ * @brief Non-owning read-only window on pixel rows
+ *
+ * A view is a pointer, a size and a row stride; copying it never copies
+ * pixels. The memory must outlive the view.
+ */
+class ConstImageView {
+public:
+    /**
+     * @brief Default constructor, creates an empty view
+     */
+    ConstImageView() : m_data(nullptr), m_width(0), m_height(0), m_stride(0) {}
+
+    /**
+     * @brief Constructor over existing memory
+     * @param data Pointer to the first pixel
+     * @param width Width of the view
+     * @param height Height of the view
+     * @param stride Distance in bytes between the starts of two rows
+     */
+    ConstImageView(const unsigned char* data, unsigned int width, unsigned int height, unsigned int stride)
+        : m_data(data), m_width(width), m_height(height), m_stride(stride) {}
+
+    /**
+     * @brief View of a whole image
+     * @param image Image to view
+     */
+    ConstImageView(const Image& image);
+
+    /**
+     * @brief Get a view of a rectangle inside this view
+     * @param rect Rectangle relative to this view
+     * @return View of the rectangle, empty if it does not fit inside this view
+     */
+    ConstImageView subView(const Rectangle& rect) const;
+
+    bool isEmpty() const { return m_data == nullptr || m_width == 0 || m_height == 0; }
+    Size size() const { return Size(m_width, m_height); }
+    unsigned int width() const { return m_width; }
+    unsigned int height() const { return m_height; }
+    unsigned int stride() const { return m_stride; }
+    const unsigned char* data() const { return m_data; }
+
+    /**
+     * @brief Get pointer to row data, checked only with IMAGE_BOUNDS_CHECK
+     * @param y Row index
+     * @return Pointer to row data
+     */
+    const unsigned char* row(unsigned int y) const {
+        checkPixelIndex(0, y, m_width, m_height);
+        return m_data + static_cast<size_t>(y) * m_stride;
+    }
+
+    /**
+     * @brief Get pointer to a pixel, checked only with IMAGE_BOUNDS_CHECK
+     * @param x X coordinate
+     * @param y Y coordinate
+     * @return Pointer to the pixel
+     */
+    const unsigned char* ptr(unsigned int x, unsigned int y) const {
+        checkPixelIndex(x, y, m_width, m_height);
+        return m_data + static_cast<size_t>(y) * m_stride + x;
+    }
+
+    /**
+     * @brief Get a range over the rows
+     * @return Range yielding a pointer to each row
+     */
+    RowRange<const unsigned char> rows() const { return RowRange<const unsigned char>(m_data, m_width, m_height, m_stride); }
+
+    /**
+     * @brief Get pixel value at specified coordinates with bounds checking
+     * @param x X coordinate
+     * @param y Y coordinate
+     * @return Pixel value
+     */
+    const unsigned char& at(unsigned int x, unsigned int y) const;
+
+private:
+    const unsigned char* m_data;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_stride;
+};
+
+/**
+ * @brief Non-owning writable window on pixel rows
+ *
+ * Like ConstImageView, but the pixels can be modified. A const ImageView
+ * still gives write access to the pixels, only the view itself is fixed.
+ */
+class ImageView {
+public:
+    /**
+     * @brief Default constructor, creates an empty view
+     */
+    ImageView() : m_data(nullptr), m_width(0), m_height(0), m_stride(0) {}
+
+    /**
+     * @brief Constructor over existing memory
+     * @param data Pointer to the first pixel
+     * @param width Width of the view
+     * @param height Height of the view
+     * @param stride Distance in bytes between the starts of two rows
+     */
+    ImageView(unsigned char* data, unsigned int width, unsigned int height, unsigned int stride)
+        : m_data(data), m_width(width), m_height(height), m_stride(stride) {}
+
+    /**
+     * @brief View of a whole image
+     * @param image Image to view
+     */
+    ImageView(Image& image);
+
+    /**
+     * @brief Read-only version of this view
+     */
+    operator ConstImageView() const { return ConstImageView(m_data, m_width, m_height, m_stride); }
+
+    /**
+     * @brief Get a view of a rectangle inside this view
+     * @param rect Rectangle relative to this view
+     * @return View of the rectangle, empty if it does not fit inside this view
+     */
+    ImageView subView(const Rectangle& rect) const;
+
+    bool isEmpty() const { return m_data == nullptr || m_width == 0 || m_height == 0; }
+    Size size() const { return Size(m_width, m_height); }
+    unsigned int width() const { return m_width; }
+    unsigned int height() const { return m_height; }
+    unsigned int stride() const { return m_stride; }
+    unsigned char* data() const { return m_data; }
+
+    /**
+     * @brief Get pointer to row data, checked only with IMAGE_BOUNDS_CHECK
+     * @param y Row index
+     * @return Pointer to row data
+     */
+    unsigned char* row(unsigned int y) const {
+        checkPixelIndex(0, y, m_width, m_height);
+        return m_data + static_cast<size_t>(y) * m_stride;
+    }
+
+    /**
+     * @brief Get pointer to a pixel, checked only with IMAGE_BOUNDS_CHECK
+     * @param x X coordinate
+     * @param y Y coordinate
+     * @return Pointer to the pixel
+     */
+    unsigned char* ptr(unsigned int x, unsigned int y) const {
+        checkPixelIndex(x, y, m_width, m_height);
+        return m_data + static_cast<size_t>(y) * m_stride + x;
+    }
+
+    /**
+     * @brief Get a range over the rows
+     * @return Range yielding a pointer to each row
+     */
+    RowRange<unsigned char> rows() const { return RowRange<unsigned char>(m_data, m_width, m_height, m_stride); }
+
+    /**
+     * @brief Access pixel value at specified coordinates with bounds checking
+     * @param x X coordinate
+     * @param y Y coordinate
+     * @return Reference to pixel value
+     */
+    unsigned char& at(unsigned int x, unsigned int y) const;
+
+private:
+    unsigned char* m_data;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_stride;
+};
+
+#endif // IMAGE_VIEW_H
@@ -0,0 +1,230 @@
+#include "Instrumentation.h"
+
+#ifdef IMAGE_INSTRUMENTATION
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <typeindex>
+#include <vector>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+namespace Instrumentation {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+    const char* name;
+    const char* category;
+    int64_t start;
+    int64_t duration;
+    unsigned int lane;
+};
+
+// Counters are keyed by the interned name pointer so that a call does not
+// build a string
+std::mutex g_statsMutex;
+std::map<const char*, CallStats> g_stats;
+
+std::atomic<uint64_t> g_liveBytes(0);
+std::atomic<uint64_t> g_peakBytes(0);
+
+std::atomic<bool> g_tracing(false);
+std::mutex g_traceMutex;
+std::vector<Event> g_events;
+
+std::atomic<unsigned int> g_nextLane(0);
+thread_local unsigned int t_lane = g_nextLane++;
+thread_local uint64_t t_allocatedBytes = 0;
+thread_local const char* t_currentCall = nullptr;
+
+const Clock::time_point g_epoch = Clock::now();
+
+int64_t microsecondsNow() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - g_epoch).count();
+}
+
+void record(const char* name, const char* category, int64_t start, int64_t end) {
+    std::lock_guard<std::mutex> lock(g_traceMutex);
+    if (g_tracing)
+        g_events.push_back(Event{name, category, start, end - start, t_lane});
+}
+
+std::string jsonEscape(const char* text) {
+    std::string escaped;
+    for (; *text; text++) {
+        if (*text == '"' || *text == '\\')
+            escaped += '\\';
+        escaped += *text;
+    }
+    return escaped;
+}
+
+} // namespace
+
+bool enabled() {
+    return true;
+}
+
+std::map<std::string, CallStats> stats() {
+    std::lock_guard<std::mutex> lock(g_statsMutex);
+    std::map<std::string, CallStats> copy;
+    for (const auto& entry : g_stats) {
+        copy[entry.first] = entry.second;
+    }
+    return copy;
+}
+
+CallStats stats(const std::string& name) {
+    std::lock_guard<std::mutex> lock(g_statsMutex);
+    for (const auto& entry : g_stats) {
+        if (name == entry.first)
+            return entry.second;
+    }
+    return CallStats();
+}
+
+void reset() {
+    std::lock_guard<std::mutex> lock(g_statsMutex);
+    g_stats.clear();
+    g_peakBytes = g_liveBytes.load();
+}
+
+uint64_t liveImageBytes() {
+    return g_liveBytes;
+}
+
+uint64_t peakImageBytes() {
+    return g_peakBytes;
+}
+
+void startTrace() {
+    std::lock_guard<std::mutex> lock(g_traceMutex);
+    g_events.clear();
+    g_tracing = true;
+}
+
+void stopTrace() {
+    std::lock_guard<std::mutex> lock(g_traceMutex);
+    g_tracing = false;
+}
+
+// Complete ("X") events with microsecond timestamps, one lane (tid) per
+// thread, named by metadata events
+bool writeTrace(const std::string& path) {
+    std::lock_guard<std::mutex> lock(g_traceMutex);
+    std::ofstream out(path);
+    out << "{\"traceEvents\": [\n";
+    std::set<unsigned int> lanes;
+    for (const Event& event : g_events) {
+        lanes.insert(event.lane);
+    }
+    bool first = true;
+    for (unsigned int lane : lanes) {
+        out << (first ? "" : ",\n") << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << lane
+            << ", \"args\": {\"name\": \"thread " << lane << "\"}}";
+        first = false;
+    }
+    for (const Event& event : g_events) {
+        out << (first ? "" : ",\n") << "  {\"name\": \"" << jsonEscape(event.name) << "\", \"cat\": \""
+            << event.category << "\", \"ph\": \"X\", \"ts\": " << event.start << ", \"dur\": " << event.duration
+            << ", \"pid\": 1, \"tid\": " << event.lane << "}";
+        first = false;
+    }
+    out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+    return static_cast<bool>(out);
+}
+
+// Names are demangled once per class and kept for the whole run
+const char* typeName(const std::type_info& type) {
+    static std::mutex namesMutex;
+    static std::map<std::type_index, std::unique_ptr<std::string>> names;
+    std::lock_guard<std::mutex> lock(namesMutex);
+    std::unique_ptr<std::string>& name = names[std::type_index(type)];
+    if (!name) {
+#if defined(__GNUG__)
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+        name.reset(new std::string(status == 0 && demangled ? demangled : type.name()));
+        std::free(demangled);
+#else
+        name.reset(new std::string(type.name()));
+#endif
+    }
+    return name->c_str();
+}
+
+CallScope::CallScope(const char* name, uint64_t pixels)
+    : m_name(name), m_outer(t_currentCall), m_pixels(pixels), m_allocatedBefore(t_allocatedBytes),
+      m_start(microsecondsNow()) {
+    t_currentCall = name;
+}
+
+CallScope::~CallScope() {
+    const int64_t end = microsecondsNow();
+    t_currentCall = m_outer;
+    const double ms = (end - m_start) / 1000.0;
+    {
+        std::lock_guard<std::mutex> lock(g_statsMutex);
+        CallStats& entry = g_stats[m_name];
+        entry.calls++;
+        entry.totalMs += ms;
+        entry.maxMs = std::max(entry.maxMs, ms);
+        entry.pixels += m_pixels;
+        entry.allocatedBytes += t_allocatedBytes - m_allocatedBefore;
+    }
+    if (g_tracing)
+        record(m_name, "call", m_start, end);
+}
+
+TraceScope::TraceScope(const char* name) : m_name(name), m_start(g_tracing ? microsecondsNow() : -1) {}
+
+TraceScope::~TraceScope() {
+    if (m_start >= 0)
+        record(m_name, "band", m_start, microsecondsNow());
+}
+
+const char* currentCall() {
+    return t_currentCall;
+}
+
+void imageAllocated(size_t bytes) {
+    t_allocatedBytes += bytes;
+    uint64_t live = g_liveBytes += bytes;
+    uint64_t peak = g_peakBytes;
+    while (live > peak && !g_peakBytes.compare_exchange_weak(peak, live)) {
+    }
+}
+
+void imageFreed(size_t bytes) {
+    g_liveBytes -= bytes;
+}
+
+} // namespace Instrumentation
+
+#else
+
+namespace Instrumentation {
+
+bool enabled() { return false; }
+std::map<std::string, CallStats> stats() { return std::map<std::string, CallStats>(); }
+CallStats stats(const std::string&) { return CallStats(); }
+void reset() {}
+uint64_t liveImageBytes() { return 0; }
+uint64_t peakImageBytes() { return 0; }
+void startTrace() {}
+void stopTrace() {}
+bool writeTrace(const std::string&) { return false; }
+
+} // namespace Instrumentation
+
+#endif // IMAGE_INSTRUMENTATION
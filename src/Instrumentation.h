@@ -0,0 +1,138 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <typeinfo>
+
+/**
+ * @brief Timing and memory counters of the processors, and a trace timeline
+ *
+ * Built in when IMAGE_INSTRUMENTATION is defined (the CMake option of the
+ * same name). Every ImageProcessing::process call is then timed and
+ * counted under the class name of the processor, Image buffers are
+ * counted as they are allocated and freed, and while a trace is recording
+ * each call and each ThreadPool band becomes an event on the lane of the
+ * thread that ran it, written in the Chrome trace-event format (load it
+ * in chrome://tracing or Perfetto).
+ *
+ * Without IMAGE_INSTRUMENTATION nothing is recorded: the functions below
+ * still exist but report empty statistics, and the processing code carries
+ * no instrumentation at all.
+ */
+namespace Instrumentation {
+
+/**
+ * @brief Counters of one processor class
+ * Time and pixels of nested calls, such as the stages of a Pipeline, are
+ * included in the calls that contain them.
+ */
+struct CallStats {
+    uint64_t calls = 0;
+    double totalMs = 0.0;
+    double maxMs = 0.0;
+    uint64_t pixels = 0;          // output pixels
+    uint64_t allocatedBytes = 0;  // Image bytes allocated by the calling thread during the calls
+};
+
+/**
+ * @brief Whether instrumentation was compiled in
+ */
+bool enabled();
+
+/**
+ * @brief Counters of every processor class called so far, by class name
+ */
+std::map<std::string, CallStats> stats();
+
+/**
+ * @brief Counters of one processor class, zero if it was never called
+ */
+CallStats stats(const std::string& name);
+
+/**
+ * @brief Clear the call counters and restart the peak at the live bytes
+ */
+void reset();
+
+/**
+ * @brief Bytes held by Image buffers allocated by Image itself
+ * Buffers handed out by Image::detach stay counted.
+ */
+uint64_t liveImageBytes();
+
+/**
+ * @brief Largest liveImageBytes() since the start or the last reset()
+ */
+uint64_t peakImageBytes();
+
+/**
+ * @brief Start recording trace events, dropping earlier ones
+ */
+void startTrace();
+
+/**
+ * @brief Stop recording trace events, keeping the recorded ones
+ */
+void stopTrace();
+
+/**
+ * @brief Write the recorded events as Chrome trace-event JSON
+ * @param path Output file
+ * @return true if the file was written
+ */
+bool writeTrace(const std::string& path);
+
+// Hooks for the library itself
+
+/**
+ * @brief Readable name of a processor class
+ */
+const char* typeName(const std::type_info& type);
+
+/**
+ * @brief Times one processor call, from construction to destruction
+ */
+class CallScope {
+public:
+    CallScope(const char* name, uint64_t pixels);
+    ~CallScope();
+    CallScope(const CallScope&) = delete;
+    CallScope& operator=(const CallScope&) = delete;
+
+private:
+    const char* m_name;
+    const char* m_outer;
+    uint64_t m_pixels;
+    uint64_t m_allocatedBefore;
+    int64_t m_start; // microseconds since the trace epoch
+};
+
+/**
+ * @brief Records a trace event without counting a call, used for ThreadPool bands
+ */
+class TraceScope {
+public:
+    explicit TraceScope(const char* name);
+    ~TraceScope();
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* m_name;
+    int64_t m_start;
+};
+
+/**
+ * @brief Name of the innermost call running on this thread, nullptr if none
+ */
+const char* currentCall();
+
+void imageAllocated(size_t bytes);
+void imageFreed(size_t bytes);
+
+} // namespace Instrumentation
+
+#endif // INSTRUMENTATION_H
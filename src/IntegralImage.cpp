@@ -0,0 +1,139 @@
+#include "IntegralImage.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+// Columns per item of the second sweep, a few cache lines of every row
+const unsigned int kColumnBlock = 256;
+
+// First sweep: prefix sums along each row, rows split into bands.
+// Second sweep: add each table row to the next one, which walks memory
+// row by row and is split into column blocks.
+template <typename T, bool Squared>
+void buildTable(const Image& image, std::vector<T>& table) {
+    const unsigned int width = image.width();
+    const unsigned int height = image.height();
+    const size_t tableWidth = static_cast<size_t>(width) + 1;
+    table.assign(tableWidth * (height + 1), 0);
+
+    ThreadPool::instance().parallelFor(height, 0, [&](unsigned int y0, unsigned int y1) {
+        for (unsigned int y = y0; y < y1; y++) {
+            const unsigned char* src = image.row(y);
+            T* dst = table.data() + (y + 1) * tableWidth + 1;
+            T running = 0;
+            for (unsigned int x = 0; x < width; x++) {
+                T value = src[x];
+                running += Squared ? value * value : value;
+                dst[x] = running;
+            }
+        }
+    });
+
+    const unsigned int columnBlocks = (width + kColumnBlock - 1) / kColumnBlock;
+    ThreadPool::instance().parallelForItems(columnBlocks, [&](unsigned int firstBlock, unsigned int endBlock) {
+        const unsigned int x0 = firstBlock * kColumnBlock;
+        const unsigned int x1 = std::min(width, endBlock * kColumnBlock);
+        for (unsigned int y = 2; y <= height; y++) {
+            const T* above = table.data() + (y - 1) * tableWidth + 1;
+            T* dst = table.data() + y * tableWidth + 1;
+            for (unsigned int x = x0; x < x1; x++) {
+                dst[x] += above[x];
+            }
+        }
+    });
+}
+
+// Unsigned wrap-around keeps the result exact as long as the rectangle
+// sum itself fits in T, which is how the table type was picked
+template <typename T>
+uint64_t rectangleSum(const std::vector<T>& table, unsigned int width, const Rectangle& rect) {
+    const size_t tableWidth = static_cast<size_t>(width) + 1;
+    const T* top = table.data() + rect.y * tableWidth;
+    const T* bottom = table.data() + (rect.y + rect.height) * tableWidth;
+    T result = bottom[rect.x + rect.width] - bottom[rect.x] - top[rect.x + rect.width] + top[rect.x];
+    return result;
+}
+
+} // namespace
+
+IntegralImage::IntegralImage() : m_width(0), m_height(0) {}
+
+IntegralImage::IntegralImage(const Image& image) : m_width(0), m_height(0) {
+    compute(image);
+}
+
+void IntegralImage::compute(const Image& image) {
+    m_sum32.clear();
+    m_sum64.clear();
+    m_squares32.clear();
+    m_squares64.clear();
+    m_width = 0;
+    m_height = 0;
+    if (image.isEmpty())
+        return;
+
+    m_width = image.width();
+    m_height = image.height();
+
+    const uint64_t pixels = static_cast<uint64_t>(m_width) * m_height;
+    const uint64_t limit = std::numeric_limits<uint32_t>::max();
+    if (pixels * 255 <= limit)
+        buildTable<uint32_t, false>(image, m_sum32);
+    else
+        buildTable<uint64_t, false>(image, m_sum64);
+    if (pixels * 255 * 255 <= limit)
+        buildTable<uint32_t, true>(image, m_squares32);
+    else
+        buildTable<uint64_t, true>(image, m_squares64);
+}
+
+uint64_t IntegralImage::sum(const Rectangle& rect) const {
+    checkRect(rect);
+    if (!m_sum32.empty())
+        return rectangleSum(m_sum32, m_width, rect);
+    return rectangleSum(m_sum64, m_width, rect);
+}
+
+uint64_t IntegralImage::squaredSum(const Rectangle& rect) const {
+    checkRect(rect);
+    if (!m_squares32.empty())
+        return rectangleSum(m_squares32, m_width, rect);
+    return rectangleSum(m_squares64, m_width, rect);
+}
+
+double IntegralImage::mean(const Rectangle& rect) const {
+    double area = static_cast<double>(rect.width) * rect.height;
+    if (area == 0)
+        throw std::invalid_argument("Rectangle must not be empty");
+    return sum(rect) / area;
+}
+
+double IntegralImage::variance(const Rectangle& rect) const {
+    double area = static_cast<double>(rect.width) * rect.height;
+    if (area == 0)
+        throw std::invalid_argument("Rectangle must not be empty");
+    double m = sum(rect) / area;
+    return std::max(0.0, squaredSum(rect) / area - m * m);
+}
+
+bool IntegralImage::isEmpty() const {
+    return m_width == 0 || m_height == 0;
+}
+
+unsigned int IntegralImage::width() const {
+    return m_width;
+}
+
+unsigned int IntegralImage::height() const {
+    return m_height;
+}
+
+// Check that the rectangle lies inside the source image
+void IntegralImage::checkRect(const Rectangle& rect) const {
+    if (rect.x > m_width || rect.width > m_width - rect.x ||
+        rect.y > m_height || rect.height > m_height - rect.y)
+        throw std::out_of_range("Rectangle out of bounds");
+}
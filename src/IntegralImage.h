@@ -0,0 +1,94 @@
+#ifndef INTEGRAL_IMAGE_H
+#define INTEGRAL_IMAGE_H
+
+#include "Image.h"
+#include "Rectangle.h"
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Summed-area tables of an image for constant time rectangle sums
+ *
+ * Holds the sums and the sums of squares of all pixels above and to the
+ * left of each position. Entries are 32 bit when every possible rectangle
+ * sum fits, 64 bit otherwise.
+ */
+class IntegralImage {
+public:
+    /**
+     * @brief Default constructor, creates empty tables
+     */
+    IntegralImage();
+
+    /**
+     * @brief Constructor that builds the tables of an image
+     * @param image Source image
+     */
+    explicit IntegralImage(const Image& image);
+
+    /**
+     * @brief Build the tables of an image, replacing the current ones
+     * @param image Source image
+     */
+    void compute(const Image& image);
+
+    /**
+     * @brief Sum of the pixels inside a rectangle
+     * @param rect Rectangle, must lie inside the image
+     * @return Sum of pixel values
+     */
+    uint64_t sum(const Rectangle& rect) const;
+
+    /**
+     * @brief Sum of the squared pixels inside a rectangle
+     * @param rect Rectangle, must lie inside the image
+     * @return Sum of squared pixel values
+     */
+    uint64_t squaredSum(const Rectangle& rect) const;
+
+    /**
+     * @brief Mean pixel value inside a rectangle
+     * @param rect Rectangle, must lie inside the image and not be empty
+     * @return Mean value
+     */
+    double mean(const Rectangle& rect) const;
+
+    /**
+     * @brief Variance of the pixel values inside a rectangle
+     * @param rect Rectangle, must lie inside the image and not be empty
+     * @return Population variance
+     */
+    double variance(const Rectangle& rect) const;
+
+    /**
+     * @brief Check if the tables are empty
+     * @return true if no image was computed, false otherwise
+     */
+    bool isEmpty() const;
+
+    /**
+     * @brief Get width of the source image
+     * @return Width of the source image
+     */
+    unsigned int width() const;
+
+    /**
+     * @brief Get height of the source image
+     * @return Height of the source image
+     */
+    unsigned int height() const;
+
+private:
+    void checkRect(const Rectangle& rect) const;
+
+    unsigned int m_width;
+    unsigned int m_height;
+
+    // Tables of (width + 1) x (height + 1) entries, only one of each pair is used
+    std::vector<uint32_t> m_sum32;
+    std::vector<uint64_t> m_sum64;
+    std::vector<uint32_t> m_squares32;
+    std::vector<uint64_t> m_squares64;
+};
+
+#endif // INTEGRAL_IMAGE_H
@@ -1,34 +1,113 @@
 #include "MeanBlur.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 
-MeanBlur::MeanBlur(int kernelSize) : ImageProcessing() {
+MeanBlur::MeanBlur(int kernelSize, Border border) : ImageProcessing() {
     m_kernelSize = kernelSize;
+    m_border = border;
 }
 
 MeanBlur::~MeanBlur() {}
 
-bool MeanBlur::process(const Image& input, Image& output) {
+// Box filter with running sums, O(1) per pixel whatever the kernel size:
+// the column sums of the current window of rows are updated by adding the
+// row that enters and subtracting the row that leaves, then each output
+// row slides a horizontal window over those column sums.
+// With BorderMode::Zero only in-bounds pixels are averaged, so near the
+// edges the divisor is the number of rows in the window times the number
+// of columns in the window; the other modes always average the full window.
+bool MeanBlur::doProcess(ConstImageView input, ImageView output) {
     if (input.isEmpty() || output.isEmpty()) {
         return false;
     }
+    if (output.width() != input.width() || output.height() != input.height()) {
+        return false;
+    }
+
+    const int width = static_cast<int>(input.width());
+    const int height = static_cast<int>(input.height());
+    const int radius = m_kernelSize / 2;
+    const uint32_t taps = static_cast<uint32_t>(2 * radius + 1);
+    const BorderMode mode = m_border.mode;
+    const bool inBoundsOnly = mode == BorderMode::Zero;
+    const unsigned char fill = mode == BorderMode::Constant ? m_border.value : 0;
+
+    // Stands in for the rows outside the image with Zero and Constant. Per
+    // thread, so that one filter can run on several images at once; the
+    // workers see their own fillRow, so pass the pointer
+    static thread_local std::vector<unsigned char> fillRow;
+    fillRow.assign(width, fill);
+    const unsigned char* outside = fillRow.data();
+    auto rowAt = [&](int y) {
+        int source = borderIndex(y, height, mode);
+        return source < 0 ? outside : input.row(source);
+    };
+
+    // Each band of output rows starts its column sums from the window
+    // around its first row; the sums are exact, so the split does not
+    // change the result
+    ThreadPool::instance().parallelFor(height, radius, [&](unsigned int firstRow, unsigned int endRow) {
+        // Column sums with radius entries on each side for the columns
+        // outside the image, refilled for every row so that the horizontal
+        // window slides without checks, and one more that the last slide
+        // reads but does not use
+        static thread_local std::vector<uint32_t> paddedSums;
+        paddedSums.assign(width + 2 * radius + 1, 0);
+        uint32_t* columnSums = paddedSums.data() + radius;
+        const int y0 = static_cast<int>(firstRow);
+        for (int y = y0 - radius; y <= y0 + radius; y++) {
+            const unsigned char* src = rowAt(y);
+            for (int x = 0; x < width; x++) {
+                columnSums[x] += src[x];
+            }
+        }
+
+        for (int y = y0; y < static_cast<int>(endRow); y++) {
+            const uint32_t rows = inBoundsOnly ? std::min(y + radius, height - 1) - std::max(y - radius, 0) + 1 : taps;
+            for (int x = -radius; x < 0; x++) {
+                int source = borderIndex(x, width, mode);
+                columnSums[x] = source < 0 ? fill * taps : columnSums[source];
+            }
+            for (int x = width; x < width + radius; x++) {
+                int source = borderIndex(x, width, mode);
+                columnSums[x] = source < 0 ? fill * taps : columnSums[source];
+            }
 
-    int radius = m_kernelSize / 2;
-    for (unsigned int y = 0; y < input.height(); y++) {
-        for (unsigned int x = 0; x < input.width(); x++) {
-            float sum = 0.0f;
-            int count = 0;
-            for (int ky = -radius; ky <= radius; ky++) {
-                for (int kx = -radius; kx <= radius; kx++) {
-                    int px = x + kx;
-                    int py = y + ky;
-                    if (px >= 0 && px < static_cast<int>(input.width()) && py >= 0 && py < static_cast<int>(input.height())) {
-                        sum += input.at(px, py);
-                        count++;
-                    }
+            uint32_t sum = 0;
+            for (int x = -radius; x <= radius; x++) {
+                sum += columnSums[x];
+            }
+
+            unsigned char* dst = output.row(y);
+            if (inBoundsOnly) {
+                for (int x = 0; x < width; x++) {
+                    const uint32_t columns = std::min(x + radius, width - 1) - std::max(x - radius, 0) + 1;
+                    dst[x] = static_cast<unsigned char>(sum / (rows * columns));
+                    sum += columnSums[x + radius + 1] - columnSums[x - radius];
+                }
+            } else {
+                const uint32_t area = taps * taps;
+                for (int x = 0; x < width; x++) {
+                    dst[x] = static_cast<unsigned char>(sum / area);
+                    sum += columnSums[x + radius + 1] - columnSums[x - radius];
                 }
             }
-            output.at(x, y) = static_cast<unsigned char>(sum / count);
+
+            const unsigned char* entering = rowAt(y + radius + 1);
+            const unsigned char* leaving = rowAt(y - radius);
+            for (int x = 0; x < width; x++) {
+                columnSums[x] += entering[x] - leaving[x];
+            }
         }
-    }
+    });
 
     return true;
-} 
\ No newline at end of file
+}
+
+// A pixel reads radius pixels on each side, and with Wrap the pixels at
+// the edges read the far side of the image
+unsigned int MeanBlur::halo() const {
+    return m_border.mode == BorderMode::Wrap ? kUnboundedHalo : static_cast<unsigned int>(m_kernelSize / 2);
+}
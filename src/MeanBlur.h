@@ -5,12 +5,27 @@
 
 class MeanBlur : public ImageProcessing {
 public:
-    MeanBlur(int kernelSize);
+    /**
+     * @brief Constructor
+     * @param kernelSize Size of the (square) window, the radius is kernelSize / 2
+     * @param border What the window reads outside the image. With
+     *               BorderMode::Zero, the default, pixels outside are left
+     *               out of the average instead of counting as black.
+     */
+    MeanBlur(int kernelSize, Border border = Border());
     ~MeanBlur();
-    bool process(const Image& input, Image& output) override;
+
+    /**
+     * @brief Window radius, unbounded with BorderMode::Wrap
+     */
+    unsigned int halo() const override;
+
+protected:
+    bool doProcess(ConstImageView input, ImageView output) override;
 
 private:
     int m_kernelSize;
+    Border m_border;
 };
 
 #endif // MEAN_BLUR_H 
\ No newline at end of file
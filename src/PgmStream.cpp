@@ -0,0 +1,187 @@
+#include "PgmStream.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+// Skip the whitespace and comments in front of the next header field
+void skipSeparators(std::istream& in) {
+    while (in) {
+        int c = in.peek();
+        if (c == '#') {
+            in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        } else if (c != EOF && isspace(c)) {
+            in.get();
+        } else {
+            break;
+        }
+    }
+}
+
+bool readHeaderField(std::istream& in, unsigned int& value) {
+    skipSeparators(in);
+    return static_cast<bool>(in >> value);
+}
+
+} // namespace
+
+PgmStripReader::PgmStripReader(unsigned int stripHeight, unsigned int overlap)
+    : m_width(0), m_height(0), m_stripHeight(std::max(1u, stripHeight)), m_overlap(overlap),
+      m_nextCore(0), m_bufferFirst(0), m_bufferEnd(0) {}
+
+// Same header as Image::load, comments allowed; the pixels start after the
+// single whitespace character that follows the maximum value
+bool PgmStripReader::open(const std::string& filename) {
+    m_file.close();
+    m_file.clear();
+    m_file.open(filename, std::ios::binary);
+    if (!m_file) {
+        std::cerr << "Error opening file: " << filename << std::endl;
+        return false;
+    }
+
+    char magic[2];
+    unsigned int maxValue = 0;
+    if (!m_file.read(magic, 2) || magic[0] != 'P' || magic[1] != '5' ||
+        !readHeaderField(m_file, m_width) || !readHeaderField(m_file, m_height) ||
+        !readHeaderField(m_file, maxValue) || m_width == 0 || m_height == 0 ||
+        maxValue == 0 || maxValue > 255 || !isspace(m_file.get())) {
+        std::cerr << "Not a PGM file" << std::endl;
+        m_width = m_height = 0;
+        return false;
+    }
+
+    m_nextCore = 0;
+    m_bufferFirst = m_bufferEnd = 0;
+    const unsigned int capacity = std::min(m_height, m_stripHeight + 2 * m_overlap);
+    if (m_buffer.width() != m_width || m_buffer.height() != capacity)
+        m_buffer = Image(m_width, capacity);
+    return true;
+}
+
+// The context rows at the bottom of the previous strip become the top of
+// this one and only the rows below them are read
+bool PgmStripReader::next(Strip& strip) {
+    if (!m_file.is_open() || finished()) {
+        return false;
+    }
+
+    const unsigned int coreEnd = std::min(m_height, m_nextCore + m_stripHeight);
+    const unsigned int first = m_nextCore > m_overlap ? m_nextCore - m_overlap : 0;
+    const unsigned int end = coreEnd + std::min(m_overlap, m_height - coreEnd);
+
+    unsigned int kept = 0;
+    if (m_bufferEnd > first) {
+        kept = m_bufferEnd - first;
+        for (unsigned int i = 0; i < kept; i++) {
+            memmove(m_buffer.row(i), m_buffer.row(first - m_bufferFirst + i), m_width);
+        }
+    }
+    for (unsigned int y = first + kept; y < end; y++) {
+        if (!m_file.read(reinterpret_cast<char*>(m_buffer.row(y - first)), m_width)) {
+            std::cerr << "Error reading row " << y << std::endl;
+            m_file.close();
+            return false;
+        }
+    }
+    m_bufferFirst = first;
+    m_bufferEnd = end;
+
+    strip.rows = ConstImageView(m_buffer).subView(Rectangle(0, 0, m_width, end - first));
+    strip.firstRow = first;
+    strip.coreOffset = m_nextCore - first;
+    strip.coreHeight = coreEnd - m_nextCore;
+    m_nextCore = coreEnd;
+    return true;
+}
+
+bool PgmStripReader::finished() const {
+    return m_height > 0 && m_nextCore == m_height;
+}
+
+unsigned int PgmStripReader::width() const {
+    return m_width;
+}
+
+unsigned int PgmStripReader::height() const {
+    return m_height;
+}
+
+unsigned int PgmStripReader::stripHeight() const {
+    return m_stripHeight;
+}
+
+unsigned int PgmStripReader::overlap() const {
+    return m_overlap;
+}
+
+PgmStripWriter::PgmStripWriter() : m_width(0), m_height(0), m_rowsWritten(0) {}
+
+PgmStripWriter::~PgmStripWriter() {
+    if (m_file.is_open())
+        close();
+}
+
+// Same header as Image::save
+bool PgmStripWriter::open(const std::string& filename, unsigned int width, unsigned int height) {
+    if (m_file.is_open())
+        close();
+    m_file.clear();
+    m_file.open(filename, std::ios::binary);
+    if (!m_file) {
+        std::cerr << "Error opening file for writing: " << filename << std::endl;
+        return false;
+    }
+    m_width = width;
+    m_height = height;
+    m_rowsWritten = 0;
+    m_file << "P5\n" << m_width << " " << m_height << "\n255\n";
+    return static_cast<bool>(m_file);
+}
+
+bool PgmStripWriter::write(ConstImageView rows) {
+    if (!m_file.is_open() || rows.width() != m_width || rows.height() > m_height - m_rowsWritten) {
+        return false;
+    }
+    for (unsigned int y = 0; y < rows.height(); y++) {
+        m_file.write(reinterpret_cast<const char*>(rows.row(y)), m_width);
+    }
+    m_rowsWritten += rows.height();
+    return static_cast<bool>(m_file);
+}
+
+bool PgmStripWriter::close() {
+    if (!m_file.is_open()) {
+        return false;
+    }
+    m_file.close();
+    return !m_file.fail() && m_rowsWritten == m_height;
+}
+
+// Each strip is processed whole, the context rows only make its core rows
+// exact. The output strip is reused, so memory stays at two strips plus
+// the processor's own per-row scratch.
+bool processStrips(ImageProcessing& processor, PgmStripReader& reader, PgmStripWriter& writer) {
+    const unsigned int halo = processor.halo();
+    if (halo == ImageProcessing::kUnboundedHalo || halo > reader.overlap()) {
+        std::cerr << "Processor halo " << halo << " exceeds the strip overlap " << reader.overlap() << std::endl;
+        return false;
+    }
+
+    Image output;
+    PgmStripReader::Strip strip;
+    while (reader.next(strip)) {
+        const ConstImageView& rows = strip.rows;
+        if (output.width() != rows.width() || output.height() < rows.height())
+            output = Image(rows.width(), std::max(output.height(), rows.height()));
+        ImageView target = ImageView(output).subView(Rectangle(0, 0, rows.width(), rows.height()));
+        if (!processor.process(rows, target))
+            return false;
+        if (!writer.write(ConstImageView(target).subView(Rectangle(0, strip.coreOffset, rows.width(), strip.coreHeight))))
+            return false;
+    }
+    return reader.finished() && writer.close();
+}
@@ -0,0 +1,127 @@
+#ifndef PGM_STREAM_H
+#define PGM_STREAM_H
+
+#include "Image.h"
+#include "ImageView.h"
+#include "ImageProcessing.h"
+#include <fstream>
+#include <string>
+
+/**
+ * @brief Reads a PGM file as consecutive strips of rows
+ *
+ * Only one strip, grown by the overlap above and below, is held in memory
+ * at a time, so files larger than the memory can be processed. Rows shared
+ * by two strips are kept from one strip to the next instead of being read
+ * twice.
+ */
+class PgmStripReader {
+public:
+    /**
+     * @brief One strip of the image
+     * rows holds the core rows with up to overlap rows of context on each
+     * side; the context is clipped at the top and bottom of the image.
+     */
+    struct Strip {
+        ConstImageView rows;       // context above, core rows, context below
+        unsigned int firstRow;     // image row of rows.row(0)
+        unsigned int coreOffset;   // index in rows of the first core row
+        unsigned int coreHeight;   // number of core rows
+    };
+
+    /**
+     * @brief Constructor
+     * @param stripHeight Number of core rows per strip (at least 1)
+     * @param overlap Rows of context above and below each strip, at least
+     *        the halo of the processor the strips are fed to
+     */
+    PgmStripReader(unsigned int stripHeight = 256, unsigned int overlap = 0);
+
+    /**
+     * @brief Open a file and read its header
+     * @param imagePath Path to a binary PGM file
+     * @return true if the file is a readable PGM, false otherwise
+     */
+    bool open(const std::string& imagePath);
+
+    /**
+     * @brief Read the next strip
+     * The strip stays valid until the next call.
+     * @param strip Receives the strip
+     * @return true if a strip was read, false at the end of the image or on a read error
+     */
+    bool next(Strip& strip);
+
+    /**
+     * @brief Check that every row of the image has been handed out
+     */
+    bool finished() const;
+
+    unsigned int width() const;
+    unsigned int height() const;
+    unsigned int stripHeight() const;
+    unsigned int overlap() const;
+
+private:
+    std::ifstream m_file;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_stripHeight;
+    unsigned int m_overlap;
+    unsigned int m_nextCore;    // first core row of the next strip
+    unsigned int m_bufferFirst; // image rows held in m_buffer: [m_bufferFirst, m_bufferEnd)
+    unsigned int m_bufferEnd;
+    Image m_buffer;             // stripHeight + 2 * overlap rows
+};
+
+/**
+ * @brief Writes a PGM file from consecutive strips of rows
+ */
+class PgmStripWriter {
+public:
+    PgmStripWriter();
+    ~PgmStripWriter();
+
+    /**
+     * @brief Create a file and write its header
+     * @param imagePath Path where to save the image
+     * @param width Image width
+     * @param height Image height
+     * @return true if the file could be created, false otherwise
+     */
+    bool open(const std::string& imagePath, unsigned int width, unsigned int height);
+
+    /**
+     * @brief Append rows below the ones already written
+     * @param rows Rows of the image width
+     * @return true if the rows were written, false on a size mismatch, too many rows or a write error
+     */
+    bool write(ConstImageView rows);
+
+    /**
+     * @brief Close the file
+     * @return true if all rows of the image were written, false otherwise
+     */
+    bool close();
+
+private:
+    std::ofstream m_file;
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_rowsWritten;
+};
+
+/**
+ * @brief Run a processor over a stream of strips
+ * Each strip is processed with its context and only its core rows are
+ * written, so the result is the same as processing the whole image, with
+ * peak memory of a few strips. Processors of unbounded halo cannot run
+ * this way.
+ * @param processor Processor to run, its halo must not exceed reader.overlap()
+ * @param reader Opened reader, read to the end
+ * @param writer Opened writer of the reader's size, closed at the end
+ * @return true if the whole image was processed and written, false otherwise
+ */
+bool processStrips(ImageProcessing& processor, PgmStripReader& reader, PgmStripWriter& writer);
+
+#endif // PGM_STREAM_H
@@ -0,0 +1,115 @@
+#include "Pipeline.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+
+// 256 x 64 output tiles keep a few scratch buffers of the grown tile well
+// inside a typical L2 cache for halos up to a few dozen pixels
+Pipeline::Pipeline() : ImageProcessing(), m_tileWidth(256), m_tileHeight(64) {}
+
+Pipeline::Pipeline(std::initializer_list<ImageProcessing*> stages) : Pipeline() {
+    m_stages.assign(stages.begin(), stages.end());
+}
+
+Pipeline::~Pipeline() {}
+
+Pipeline& Pipeline::add(ImageProcessing& stage) {
+    m_stages.push_back(&stage);
+    return *this;
+}
+
+void Pipeline::setTileSize(unsigned int width, unsigned int height) {
+    m_tileWidth = std::max(1u, width);
+    m_tileHeight = std::max(1u, height);
+}
+
+unsigned int Pipeline::halo() const {
+    unsigned int total = 0;
+    for (ImageProcessing* stage : m_stages) {
+        unsigned int halo = stage->halo();
+        if (halo == kUnboundedHalo || total > kUnboundedHalo - halo)
+            return kUnboundedHalo;
+        total += halo;
+    }
+    return total;
+}
+
+bool Pipeline::doProcess(ConstImageView input, ImageView output) {
+    if (input.isEmpty() || output.isEmpty()) {
+        return false;
+    }
+    if (output.width() != input.width() || output.height() != input.height()) {
+        return false;
+    }
+    if (m_stages.empty()) {
+        copyPixels(input, output);
+        return true;
+    }
+
+    const unsigned int totalHalo = halo();
+    if (totalHalo == kUnboundedHalo) {
+        return processWholeImages(input, output);
+    }
+
+    const unsigned int width = input.width();
+    const unsigned int height = input.height();
+    const unsigned int tilesX = (width + m_tileWidth - 1) / m_tileWidth;
+    const unsigned int tilesY = (height + m_tileHeight - 1) / m_tileHeight;
+    const unsigned int scratchWidth = std::min(width, m_tileWidth + 2 * std::min(totalHalo, width));
+    const unsigned int scratchHeight = std::min(height, m_tileHeight + 2 * std::min(totalHalo, height));
+    std::atomic<bool> ok(true);
+
+    ThreadPool::instance().parallelForItems(tilesX * tilesY, [&](unsigned int first, unsigned int end) {
+        // Two buffers of the largest grown tile, written by stages in turn
+        static thread_local Image scratchBuffers[2];
+        const ImageView scratch[2] = {scratchView(scratchBuffers[0], scratchWidth, scratchHeight),
+                                      scratchView(scratchBuffers[1], scratchWidth, scratchHeight)};
+
+        for (unsigned int tile = first; tile < end; tile++) {
+            Rectangle target((tile % tilesX) * m_tileWidth, (tile / tilesX) * m_tileHeight, 0, 0);
+            target.width = std::min(m_tileWidth, width - target.x);
+            target.height = std::min(m_tileHeight, height - target.y);
+
+            // Stage k reads the region grown by the halos from stage k on
+            // and writes all of it; only the part grown by the halos after
+            // stage k is exact, and that is all the next stage reads
+            unsigned int remaining = totalHalo;
+            Rectangle region = grow(target, remaining, width, height);
+            ConstImageView stageInput = input.subView(region);
+            for (size_t k = 0; k < m_stages.size(); k++) {
+                ImageView stageOutput = scratch[k % 2].subView(Rectangle(0, 0, region.width, region.height));
+                if (!m_stages[k]->process(stageInput, stageOutput)) {
+                    ok = false;
+                    return;
+                }
+                remaining -= m_stages[k]->halo();
+                Rectangle next = grow(target, remaining, width, height);
+                stageInput = ConstImageView(stageOutput).subView(
+                    Rectangle(next.x - region.x, next.y - region.y, next.width, next.height));
+                region = next;
+            }
+
+            copyPixels(stageInput, output.subView(target));
+        }
+    });
+
+    return ok;
+}
+
+// Stage by stage on whole images, for chains that cannot be tiled
+bool Pipeline::processWholeImages(ConstImageView input, ImageView output) {
+    ConstImageView stageInput = input;
+    for (size_t k = 0; k < m_stages.size(); k++) {
+        ImageView stageOutput = output;
+        if (k + 1 < m_stages.size()) {
+            Image& intermediate = m_intermediate[k % 2];
+            if (intermediate.width() != input.width() || intermediate.height() != input.height())
+                intermediate = Image(input.width(), input.height());
+            stageOutput = intermediate;
+        }
+        if (!m_stages[k]->process(stageInput, stageOutput))
+            return false;
+        stageInput = stageOutput;
+    }
+    return true;
+}
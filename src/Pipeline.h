@@ -0,0 +1,77 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "ImageProcessing.h"
+#include <initializer_list>
+#include <vector>
+
+/**
+ * @brief Chain of processors run tile by tile
+ *
+ * Each output tile is computed through the whole chain before the next one,
+ * so intermediates live in small per-thread scratch buffers that stay in
+ * cache instead of full-size images: the input is read about once and the
+ * output written once, whatever the length of the chain. Tiles run in
+ * parallel on the ThreadPool.
+ *
+ * Every stage computes its tile grown by the halos of the stages after it,
+ * clipped to the image, so the result is the same as running the stages
+ * one after the other on whole images. A chain with a stage of unbounded
+ * halo (RecursiveGaussianBlur) runs stage by stage on whole images.
+ *
+ * Stages are not owned and must outlive the pipeline. They may run on
+ * several tiles at once, which all built-in processors except
+ * RecursiveGaussianBlur support.
+ */
+class Pipeline : public ImageProcessing {
+public:
+    /**
+     * @brief Constructor for an empty pipeline, which copies its input
+     */
+    Pipeline();
+
+    /**
+     * @brief Constructor from a sequence of stages
+     * @param stages Stages in the order they run
+     */
+    Pipeline(std::initializer_list<ImageProcessing*> stages);
+
+    ~Pipeline();
+
+    /**
+     * @brief Append a stage
+     * @param stage Stage run after the current last one
+     * @return Reference to this pipeline
+     */
+    Pipeline& add(ImageProcessing& stage);
+
+    /**
+     * @brief Set the size of the output tiles
+     * @param width Tile width in pixels
+     * @param height Tile height in pixels
+     */
+    void setTileSize(unsigned int width, unsigned int height);
+
+    /**
+     * @brief Sum of the halos of the stages
+     */
+    unsigned int halo() const override;
+
+protected:
+    /**
+     * @brief Run all stages
+     * @param input Source image
+     * @param output Destination image, must have the size of input
+     */
+    bool doProcess(ConstImageView input, ImageView output) override;
+
+private:
+    bool processWholeImages(ConstImageView input, ImageView output);
+
+    std::vector<ImageProcessing*> m_stages;
+    unsigned int m_tileWidth;
+    unsigned int m_tileHeight;
+    Image m_intermediate[2]; // whole-image fallback only
+};
+
+#endif // PIPELINE_H
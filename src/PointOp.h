@@ -0,0 +1,92 @@
+#ifndef POINT_OP_H
+#define POINT_OP_H
+
+#include "ImageProcessing.h"
+#include <functional>
+
+/**
+ * @brief Pixel-wise 8-bit to 8-bit mapping applied through a 256-entry table
+ *
+ * The mapping is evaluated once per possible value when the table is built,
+ * so applying it costs one lookup per pixel whatever the mapping. Chains of
+ * point operations fuse with then() into a single table, and so into a
+ * single pass over the image. Input and output may be the same image.
+ */
+class PointOp : public ImageProcessing {
+public:
+    /**
+     * @brief Default constructor, creates the identity mapping
+     */
+    PointOp();
+
+    /**
+     * @brief Constructor that tabulates a mapping
+     * @param mapping Function called once for each value 0..255
+     */
+    explicit PointOp(const std::function<unsigned char(unsigned char)>& mapping);
+
+    ~PointOp();
+
+    /**
+     * @brief Fuse this mapping with one applied after it
+     * @param next Mapping applied to the output of this one
+     * @return Single mapping equivalent to this one followed by next
+     */
+    PointOp then(const PointOp& next) const;
+
+    /**
+     * @brief Map a single value
+     * @param value Input value
+     * @return Mapped value
+     */
+    unsigned char operator()(unsigned char value) const { return m_table[value]; }
+
+    /**
+     * @brief Get the table
+     * @return Pointer to the 256 mapped values
+     */
+    const unsigned char* table() const { return m_table; }
+
+    /**
+     * @brief Gamma correction, 255 * (value / 255)^gamma
+     * @param gamma Gamma value (gamma > 0)
+     */
+    static PointOp gamma(float gamma);
+
+    /**
+     * @brief Brightness and contrast, value * factor + bias clamped to [0, 255]
+     * @param factor Contrast factor (factor > 0)
+     * @param bias Brightness
+     */
+    static PointOp brightnessContrast(float factor, float bias);
+
+    /**
+     * @brief Same as Image::operator+(unsigned char), clamped to 255
+     * @param scalar Value to add
+     */
+    static PointOp add(unsigned char scalar);
+
+    /**
+     * @brief Same as Image::operator-(unsigned char), clamped to 0
+     * @param scalar Value to subtract
+     */
+    static PointOp subtract(unsigned char scalar);
+
+    /**
+     * @brief Same as Image::operator*(float), clamped to 255
+     * @param scalar Value to multiply with
+     */
+    static PointOp multiply(float scalar);
+
+protected:
+    /**
+     * @brief Map every pixel through the table
+     * @param input Source image
+     * @param output Destination image, must have the size of input
+     */
+    bool doProcess(ConstImageView input, ImageView output) override;
+
+    unsigned char m_table[256];
+};
+
+#endif // POINT_OP_H
@@ -0,0 +1,63 @@
+#ifndef RECURSIVE_GAUSSIAN_BLUR_H
+#define RECURSIVE_GAUSSIAN_BLUR_H
+
+#include "ImageProcessing.h"
+#include <vector>
+
+/**
+ * @brief Gaussian blur with a recursive (IIR) filter whose cost does not depend on sigma
+ *
+ * Implements the third order filter of Young and van Vliet: one causal and
+ * one anti-causal pass per row, then the same per column. Pixels outside
+ * the image count as zero, like GaussianBlur.
+ *
+ * Accuracy against GaussianBlur(6 * sigma + 1, sigma), measured on noisy
+ * test images with hard 0/255 edges (max / mean absolute difference):
+ *   sigma 20..60: 2 LSB / 0.2-0.5 LSB, borders included
+ *   sigma 3..10:  6 LSB / 0.5-0.8 LSB
+ *   sigma 0.8..2: up to 30 LSB / 0.6-1.9 LSB, the third order filter is a
+ *                 poor fit for small kernels; use GaussianBlur there
+ */
+class RecursiveGaussianBlur : public ImageProcessing {
+public:
+    /**
+     * @brief Constructor for recursive Gaussian blur
+     * @param sigma Standard deviation of the Gaussian (sigma >= 0.5)
+     */
+    RecursiveGaussianBlur(float sigma);
+    ~RecursiveGaussianBlur();
+
+    unsigned int halo() const override;
+
+protected:
+    /**
+     * @brief Blur the image
+     * @param input Source image
+     * @param output Destination image, must have the size of input
+     */
+    bool doProcess(ConstImageView input, ImageView output) override;
+
+    /**
+     * @brief Blur only a region of the image
+     * The rows still run over the whole width and the columns over the
+     * whole height, but only the columns of roi are filtered vertically.
+     * @param input Source image
+     * @param output Destination image, must have the size of input
+     * @param roi Region to compute, must lie inside input
+     */
+    bool doProcess(ConstImageView input, ImageView output, const Rectangle& roi) override;
+
+private:
+    void run(ConstImageView input, ImageView output, const Rectangle& roi);
+
+    float m_sigma;
+    double m_b1; // feedback coefficients, already divided by b0
+    double m_b2;
+    double m_b3;
+    double m_gain; // B, the input weight of each pass
+    double m_tail[3][3]; // anti-causal start state from the last three causal outputs
+    std::vector<double> m_buffer; // scratch, kept between calls to avoid reallocating
+    std::vector<double> m_line;
+};
+
+#endif // RECURSIVE_GAUSSIAN_BLUR_H
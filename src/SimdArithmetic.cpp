@@ -0,0 +1,503 @@
+#include "SimdArithmetic.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SIMD_ARITHMETIC_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// GCC and Clang compile each variant for its own instruction set through a
+// target attribute, so the rest of the build keeps the baseline flags.
+// MSVC accepts the intrinsics without it.
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+namespace {
+
+// Exact a * b / 255 truncated, for a * b <= 255 * 255: x / 255 == (x + 1 + (x >> 8)) >> 8
+inline unsigned int divide255(unsigned int x) {
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+// Scalar kernels, also used for the tails of the vector ones
+
+void addScalarIsa(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = static_cast<unsigned char>(std::min(255, static_cast<int>(a[i]) + static_cast<int>(b[i])));
+    }
+}
+
+void subtractScalarIsa(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = static_cast<unsigned char>(std::max(0, static_cast<int>(a[i]) - static_cast<int>(b[i])));
+    }
+}
+
+void multiplyScalarIsa(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = static_cast<unsigned char>(divide255(static_cast<unsigned int>(a[i]) * b[i]));
+    }
+}
+
+void addConstantScalarIsa(const unsigned char* a, unsigned char scalar, unsigned char* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = static_cast<unsigned char>(std::min(255, static_cast<int>(a[i]) + static_cast<int>(scalar)));
+    }
+}
+
+void subtractConstantScalarIsa(const unsigned char* a, unsigned char scalar, unsigned char* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = static_cast<unsigned char>(std::max(0, static_cast<int>(a[i]) - static_cast<int>(scalar)));
+    }
+}
+
+// Four independent lookups per iteration keep the loads in flight
+void lookupScalarIsa(const unsigned char* a, const unsigned char* table, unsigned char* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        unsigned char v0 = table[a[i]];
+        unsigned char v1 = table[a[i + 1]];
+        unsigned char v2 = table[a[i + 2]];
+        unsigned char v3 = table[a[i + 3]];
+        dst[i] = v0;
+        dst[i + 1] = v1;
+        dst[i + 2] = v2;
+        dst[i + 3] = v3;
+    }
+    for (; i < count; i++) {
+        dst[i] = table[a[i]];
+    }
+}
+
+const SimdArithmetic::Kernels kScalar = {
+    SimdArithmetic::Isa::Scalar, "scalar",
+    addScalarIsa, subtractScalarIsa, multiplyScalarIsa, addConstantScalarIsa, subtractConstantScalarIsa,
+    lookupScalarIsa
+};
+
+#ifdef SIMD_ARITHMETIC_X86
+
+// SSE2, 16 pixels per step
+
+SIMD_TARGET("sse2")
+void addSse2(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_adds_epu8(va, vb));
+    }
+    addScalarIsa(a + i, b + i, dst + i, count - i);
+}
+
+SIMD_TARGET("sse2")
+void subtractSse2(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_subs_epu8(va, vb));
+    }
+    subtractScalarIsa(a + i, b + i, dst + i, count - i);
+}
+
+// Products of two bytes fit 16 bits, so the bytes are widened, multiplied
+// with mullo, divided by 255 with the shift form and packed back
+SIMD_TARGET("sse2")
+inline __m128i divide255Sse2(__m128i x) {
+    __m128i t = _mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_srli_epi16(x, 8));
+    return _mm_srli_epi16(t, 8);
+}
+
+SIMD_TARGET("sse2")
+void multiplySse2(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+        __m128i result = _mm_packus_epi16(divide255Sse2(lo), divide255Sse2(hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), result);
+    }
+    multiplyScalarIsa(a + i, b + i, dst + i, count - i);
+}
+
+SIMD_TARGET("sse2")
+void addConstantSse2(const unsigned char* a, unsigned char scalar, unsigned char* dst, size_t count) {
+    const __m128i vs = _mm_set1_epi8(static_cast<char>(scalar));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_adds_epu8(va, vs));
+    }
+    addConstantScalarIsa(a + i, scalar, dst + i, count - i);
+}
+
+SIMD_TARGET("sse2")
+void subtractConstantSse2(const unsigned char* a, unsigned char scalar, unsigned char* dst, size_t count) {
+    const __m128i vs = _mm_set1_epi8(static_cast<char>(scalar));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_subs_epu8(va, vs));
+    }
+    subtractConstantScalarIsa(a + i, scalar, dst + i, count - i);
+}
+
+const SimdArithmetic::Kernels kSse2 = {
+    SimdArithmetic::Isa::SSE2, "sse2",
+    addSse2, subtractSse2, multiplySse2, addConstantSse2, subtractConstantSse2, lookupScalarIsa
+};
+
+// SSSE3 lookup, 16 pixels per step. The table is 16 rows of 16 bytes, one
+// per high nibble; pshufb looks the low nibble up in every row and the row
+// of each pixel's high nibble is kept
+
+SIMD_TARGET("ssse3")
+void lookupSsse3(const unsigned char* a, const unsigned char* table, unsigned char* dst, size_t count) {
+    __m128i rows[16];
+    for (int h = 0; h < 16; h++) {
+        rows[h] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16 * h));
+    }
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i low = _mm_and_si128(va, nibble);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(va, 4), nibble);
+        __m128i result = _mm_setzero_si128();
+        for (int h = 0; h < 16; h++) {
+            __m128i select = _mm_cmpeq_epi8(high, _mm_set1_epi8(static_cast<char>(h)));
+            result = _mm_or_si128(result, _mm_and_si128(select, _mm_shuffle_epi8(rows[h], low)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), result);
+    }
+    lookupScalarIsa(a + i, table, dst + i, count - i);
+}
+
+const SimdArithmetic::Kernels kSsse3 = {
+    SimdArithmetic::Isa::SSSE3, "ssse3",
+    addSse2, subtractSse2, multiplySse2, addConstantSse2, subtractConstantSse2, lookupSsse3
+};
+
+// AVX2, 32 pixels per step. unpack and pack both work within 128-bit
+// lanes, so the pixel order comes out unchanged
+
+SIMD_TARGET("avx2")
+void addAvx2(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_adds_epu8(va, vb));
+    }
+    addScalarIsa(a + i, b + i, dst + i, count - i);
+}
+
+SIMD_TARGET("avx2")
+void subtractAvx2(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_subs_epu8(va, vb));
+    }
+    subtractScalarIsa(a + i, b + i, dst + i, count - i);
+}
+
+SIMD_TARGET("avx2")
+inline __m256i divide255Avx2(__m256i x) {
+    __m256i t = _mm256_add_epi16(_mm256_add_epi16(x, _mm256_set1_epi16(1)), _mm256_srli_epi16(x, 8));
+    return _mm256_srli_epi16(t, 8);
+}
+
+SIMD_TARGET("avx2")
+void multiplyAvx2(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), _mm256_unpacklo_epi8(vb, zero));
+        __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), _mm256_unpackhi_epi8(vb, zero));
+        __m256i result = _mm256_packus_epi16(divide255Avx2(lo), divide255Avx2(hi));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), result);
+    }
+    multiplyScalarIsa(a + i, b + i, dst + i, count - i);
+}
+
+SIMD_TARGET("avx2")
+void addConstantAvx2(const unsigned char* a, unsigned char scalar, unsigned char* dst, size_t count) {
+    const __m256i vs = _mm256_set1_epi8(static_cast<char>(scalar));
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_adds_epu8(va, vs));
+    }
+    addConstantScalarIsa(a + i, scalar, dst + i, count - i);
+}
+
+SIMD_TARGET("avx2")
+void subtractConstantAvx2(const unsigned char* a, unsigned char scalar, unsigned char* dst, size_t count) {
+    const __m256i vs = _mm256_set1_epi8(static_cast<char>(scalar));
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_subs_epu8(va, vs));
+    }
+    subtractConstantScalarIsa(a + i, scalar, dst + i, count - i);
+}
+
+// Same nibble split as SSSE3; pshufb works within 128-bit lanes, so each
+// table row is broadcast to both
+SIMD_TARGET("avx2")
+void lookupAvx2(const unsigned char* a, const unsigned char* table, unsigned char* dst, size_t count) {
+    __m256i rows[16];
+    for (int h = 0; h < 16; h++) {
+        rows[h] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16 * h)));
+    }
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i low = _mm256_and_si256(va, nibble);
+        __m256i high = _mm256_and_si256(_mm256_srli_epi16(va, 4), nibble);
+        __m256i result = _mm256_setzero_si256();
+        for (int h = 0; h < 16; h++) {
+            __m256i select = _mm256_cmpeq_epi8(high, _mm256_set1_epi8(static_cast<char>(h)));
+            result = _mm256_or_si256(result, _mm256_and_si256(select, _mm256_shuffle_epi8(rows[h], low)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), result);
+    }
+    lookupScalarIsa(a + i, table, dst + i, count - i);
+}
+
+const SimdArithmetic::Kernels kAvx2 = {
+    SimdArithmetic::Isa::AVX2, "avx2",
+    addAvx2, subtractAvx2, multiplyAvx2, addConstantAvx2, subtractConstantAvx2, lookupAvx2
+};
+
+// AVX-512BW, 64 pixels per step; the tail is handled with masked loads
+// and stores instead of the scalar loop
+
+SIMD_TARGET("avx512f,avx512bw")
+inline __mmask64 tailMask(size_t remaining) {
+    return remaining >= 64 ? ~__mmask64(0) : (__mmask64(1) << remaining) - 1;
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+void addAvx512(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    for (size_t i = 0; i < count; i += 64) {
+        __mmask64 mask = tailMask(count - i);
+        __m512i va = _mm512_maskz_loadu_epi8(mask, a + i);
+        __m512i vb = _mm512_maskz_loadu_epi8(mask, b + i);
+        _mm512_mask_storeu_epi8(dst + i, mask, _mm512_adds_epu8(va, vb));
+    }
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+void subtractAvx512(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    for (size_t i = 0; i < count; i += 64) {
+        __mmask64 mask = tailMask(count - i);
+        __m512i va = _mm512_maskz_loadu_epi8(mask, a + i);
+        __m512i vb = _mm512_maskz_loadu_epi8(mask, b + i);
+        _mm512_mask_storeu_epi8(dst + i, mask, _mm512_subs_epu8(va, vb));
+    }
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+inline __m512i divide255Avx512(__m512i x) {
+    __m512i t = _mm512_add_epi16(_mm512_add_epi16(x, _mm512_set1_epi16(1)), _mm512_srli_epi16(x, 8));
+    return _mm512_srli_epi16(t, 8);
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+void multiplyAvx512(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count) {
+    const __m512i zero = _mm512_setzero_si512();
+    for (size_t i = 0; i < count; i += 64) {
+        __mmask64 mask = tailMask(count - i);
+        __m512i va = _mm512_maskz_loadu_epi8(mask, a + i);
+        __m512i vb = _mm512_maskz_loadu_epi8(mask, b + i);
+        __m512i lo = _mm512_mullo_epi16(_mm512_unpacklo_epi8(va, zero), _mm512_unpacklo_epi8(vb, zero));
+        __m512i hi = _mm512_mullo_epi16(_mm512_unpackhi_epi8(va, zero), _mm512_unpackhi_epi8(vb, zero));
+        __m512i result = _mm512_packus_epi16(divide255Avx512(lo), divide255Avx512(hi));
+        _mm512_mask_storeu_epi8(dst + i, mask, result);
+    }
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+void addConstantAvx512(const unsigned char* a, unsigned char scalar, unsigned char* dst, size_t count) {
+    const __m512i vs = _mm512_set1_epi8(static_cast<char>(scalar));
+    for (size_t i = 0; i < count; i += 64) {
+        __mmask64 mask = tailMask(count - i);
+        __m512i va = _mm512_maskz_loadu_epi8(mask, a + i);
+        _mm512_mask_storeu_epi8(dst + i, mask, _mm512_adds_epu8(va, vs));
+    }
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+void subtractConstantAvx512(const unsigned char* a, unsigned char scalar, unsigned char* dst, size_t count) {
+    const __m512i vs = _mm512_set1_epi8(static_cast<char>(scalar));
+    for (size_t i = 0; i < count; i += 64) {
+        __mmask64 mask = tailMask(count - i);
+        __m512i va = _mm512_maskz_loadu_epi8(mask, a + i);
+        _mm512_mask_storeu_epi8(dst + i, mask, _mm512_subs_epu8(va, vs));
+    }
+}
+
+// Nibble split again, the masked shuffle writing only the pixels of each
+// table row
+SIMD_TARGET("avx512f,avx512bw")
+void lookupAvx512(const unsigned char* a, const unsigned char* table, unsigned char* dst, size_t count) {
+    __m512i rows[16];
+    for (int h = 0; h < 16; h++) {
+        rows[h] = _mm512_broadcast_i32x4(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16 * h)));
+    }
+    const __m512i nibble = _mm512_set1_epi8(0x0f);
+    for (size_t i = 0; i < count; i += 64) {
+        __mmask64 mask = tailMask(count - i);
+        __m512i va = _mm512_maskz_loadu_epi8(mask, a + i);
+        __m512i low = _mm512_and_si512(va, nibble);
+        __m512i high = _mm512_and_si512(_mm512_srli_epi16(va, 4), nibble);
+        __m512i result = _mm512_setzero_si512();
+        for (int h = 0; h < 16; h++) {
+            __mmask64 select = _mm512_cmpeq_epi8_mask(high, _mm512_set1_epi8(static_cast<char>(h)));
+            result = _mm512_mask_shuffle_epi8(result, select, rows[h], low);
+        }
+        _mm512_mask_storeu_epi8(dst + i, mask, result);
+    }
+}
+
+const SimdArithmetic::Kernels kAvx512 = {
+    SimdArithmetic::Isa::AVX512BW, "avx512bw",
+    addAvx512, subtractAvx512, multiplyAvx512, addConstantAvx512, subtractConstantAvx512, lookupAvx512
+};
+
+// AVX-512 VBMI: vpermi2b indexes 128 bytes of two registers with the low
+// seven bits, so two of them cover both halves of the table and bit 7 of
+// each pixel picks the half
+SIMD_TARGET("avx512f,avx512bw,avx512vbmi")
+void lookupAvx512Vbmi(const unsigned char* a, const unsigned char* table, unsigned char* dst, size_t count) {
+    const __m512i t0 = _mm512_loadu_si512(table);
+    const __m512i t1 = _mm512_loadu_si512(table + 64);
+    const __m512i t2 = _mm512_loadu_si512(table + 128);
+    const __m512i t3 = _mm512_loadu_si512(table + 192);
+    for (size_t i = 0; i < count; i += 64) {
+        __mmask64 mask = tailMask(count - i);
+        __m512i va = _mm512_maskz_loadu_epi8(mask, a + i);
+        __m512i low = _mm512_permutex2var_epi8(t0, va, t1);
+        __m512i high = _mm512_permutex2var_epi8(t2, va, t3);
+        __m512i result = _mm512_mask_blend_epi8(_mm512_movepi8_mask(va), low, high);
+        _mm512_mask_storeu_epi8(dst + i, mask, result);
+    }
+}
+
+const SimdArithmetic::Kernels kAvx512Vbmi = {
+    SimdArithmetic::Isa::AVX512VBMI, "avx512vbmi",
+    addAvx512, subtractAvx512, multiplyAvx512, addConstantAvx512, subtractConstantAvx512, lookupAvx512Vbmi
+};
+
+// CPUID leaf 7 for AVX2 / AVX-512BW, plus XGETBV to check that the OS
+// saves the wider registers
+void cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for (int i = 0; i < 4; i++) regs[i] = static_cast<unsigned int>(r[i]);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+unsigned long long xgetbv0() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+}
+
+struct CpuFeatures {
+    bool sse2 = false;
+    bool ssse3 = false;
+    bool avx2 = false;
+    bool avx512bw = false;
+    bool avx512vbmi = false;
+};
+
+CpuFeatures detectCpu() {
+    CpuFeatures features;
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    unsigned int maxLeaf = regs[0];
+
+    cpuid(1, 0, regs);
+    features.sse2 = (regs[3] >> 26) & 1;
+    features.ssse3 = (regs[2] >> 9) & 1;
+    bool osxsave = (regs[2] >> 27) & 1;
+    if (!osxsave || maxLeaf < 7)
+        return features;
+
+    unsigned long long xcr0 = xgetbv0();
+    bool ymmSaved = (xcr0 & 0x6) == 0x6;
+    bool zmmSaved = (xcr0 & 0xe6) == 0xe6;
+
+    cpuid(7, 0, regs);
+    features.avx2 = ymmSaved && ((regs[1] >> 5) & 1);
+    features.avx512bw = zmmSaved && ((regs[1] >> 16) & 1) && ((regs[1] >> 30) & 1); // AVX512F and AVX512BW
+    features.avx512vbmi = features.avx512bw && ((regs[2] >> 1) & 1);
+    return features;
+}
+
+const CpuFeatures& cpuFeatures() {
+    static const CpuFeatures features = detectCpu();
+    return features;
+}
+
+#endif // SIMD_ARITHMETIC_X86
+
+} // namespace
+
+const SimdArithmetic::Kernels* SimdArithmetic::kernels(Isa isa) {
+    switch (isa) {
+    case Isa::Scalar:
+        return &kScalar;
+#ifdef SIMD_ARITHMETIC_X86
+    case Isa::SSE2:
+        return cpuFeatures().sse2 ? &kSse2 : nullptr;
+    case Isa::SSSE3:
+        return cpuFeatures().ssse3 ? &kSsse3 : nullptr;
+    case Isa::AVX2:
+        return cpuFeatures().avx2 ? &kAvx2 : nullptr;
+    case Isa::AVX512BW:
+        return cpuFeatures().avx512bw ? &kAvx512 : nullptr;
+    case Isa::AVX512VBMI:
+        return cpuFeatures().avx512vbmi ? &kAvx512Vbmi : nullptr;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+const SimdArithmetic::Kernels& SimdArithmetic::best() {
+    static const Kernels* chosen = [] {
+        for (Isa isa : {Isa::AVX512VBMI, Isa::AVX512BW, Isa::AVX2, Isa::SSSE3, Isa::SSE2}) {
+            if (const Kernels* k = kernels(isa))
+                return k;
+        }
+        return &kScalar;
+    }();
+    return *chosen;
+}
@@ -0,0 +1,48 @@
+#ifndef SIMD_ARITHMETIC_H
+#define SIMD_ARITHMETIC_H
+
+#include <cstddef>
+
+/**
+ * @brief Row kernels behind the Image arithmetic operators
+ *
+ * Each instruction set has its own kernels; the best one the CPU supports
+ * is picked once at runtime from CPUID, so one binary runs on every host.
+ * All variants give bit-identical results to the scalar one:
+ *   add, subtract: saturating to [0, 255]
+ *   multiply:      a * b / 255, truncated
+ *   lookup:        table[a], through a 256-entry table
+ *
+ * SSSE3 and AVX-512 VBMI only add a faster lookup to the arithmetic of
+ * SSE2 and AVX-512BW: pshufb looks up 16 bytes at once, vpermi2b 128.
+ */
+namespace SimdArithmetic {
+
+    enum class Isa { Scalar, SSE2, SSSE3, AVX2, AVX512BW, AVX512VBMI };
+
+    struct Kernels {
+        Isa isa;
+        const char* name;
+        void (*add)(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count);
+        void (*subtract)(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count);
+        void (*multiply)(const unsigned char* a, const unsigned char* b, unsigned char* dst, size_t count);
+        void (*addScalar)(const unsigned char* a, unsigned char scalar, unsigned char* dst, size_t count);
+        void (*subtractScalar)(const unsigned char* a, unsigned char scalar, unsigned char* dst, size_t count);
+        void (*lookup)(const unsigned char* a, const unsigned char* table, unsigned char* dst, size_t count);
+    };
+
+    /**
+     * @brief Get the kernels of an instruction set
+     * @param isa Instruction set
+     * @return Kernels, nullptr if this CPU or build does not support isa
+     */
+    const Kernels* kernels(Isa isa);
+
+    /**
+     * @brief Get the kernels of the best instruction set this CPU supports
+     * @return Kernels, chosen on the first call
+     */
+    const Kernels& best();
+}
+
+#endif // SIMD_ARITHMETIC_H
@@ -1,84 +1,148 @@
 #include "SobelFilter.h"
+#include "Instrumentation.h"
+#include "ThreadPool.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 
-SobelFilter::SobelFilter() : ImageProcessing() {
-    m_kernelSize = 3;
-    m_kernel = new float*[m_kernelSize];
-    m_verticalKernel = new float*[m_kernelSize];
-    for (int i = 0; i < m_kernelSize; i++) {
-        m_kernel[i] = new float[m_kernelSize];
-        m_verticalKernel[i] = new float[m_kernelSize];
-    }
-
-    m_kernel[0][0] = -1; m_kernel[0][1] = 0; m_kernel[0][2] = 1;
-    m_kernel[1][0] = -2; m_kernel[1][1] = 0; m_kernel[1][2] = 2;
-    m_kernel[2][0] = -1; m_kernel[2][1] = 0; m_kernel[2][2] = 1;
+SobelFilter::SobelFilter(Norm norm, Border border) : ImageProcessing() {
+    m_norm = norm;
+    m_border = border;
+}
 
-    m_verticalKernel[0][0] = -1; m_verticalKernel[0][1] = -2; m_verticalKernel[0][2] = -1;
-    m_verticalKernel[1][0] = 0;  m_verticalKernel[1][1] = 0;  m_verticalKernel[1][2] = 0;
-    m_verticalKernel[2][0] = 1;  m_verticalKernel[2][1] = 2;  m_verticalKernel[2][2] = 1;
+SobelFilter::~SobelFilter() {}
 
-    m_factor = 1.0f;
-    m_bias = 0.0f;
+bool SobelFilter::doProcess(ConstImageView input, ImageView output) {
+    return run(input, output, nullptr, false);
 }
 
-SobelFilter::~SobelFilter() {
-    for (int i = 0; i < m_kernelSize; i++) {
-        delete[] m_kernel[i];
-        delete[] m_verticalKernel[i];
-    }
-    delete[] m_kernel;
-    delete[] m_verticalKernel;
+// Bypasses doProcess, so it opens the call scope ImageProcessing::process would
+bool SobelFilter::process(ConstImageView input, ImageView output, Gradients& gradients, bool withOrientation) {
+#ifdef IMAGE_INSTRUMENTATION
+    Instrumentation::CallScope scope(Instrumentation::typeName(typeid(*this)),
+                                     static_cast<uint64_t>(output.width()) * output.height());
+#endif
+    return run(input, output, &gradients, withOrientation);
 }
 
-bool SobelFilter::process(const Image& input, Image& output) {
+// Both kernels are separable:
+//   Gx = [1 2 1]^T * [-1 0 1], so Gx[x] = s[x + 1] - s[x - 1] with s = top + 2 * middle + bottom
+//   Gy = [-1 0 1]^T * [1 2 1], so Gy[x] = d[x - 1] + 2 * d[x] + d[x + 1] with d = bottom - top
+// |s| <= 1020 and |Gx|, |Gy| <= 1020, so everything fits 16 bits
+bool SobelFilter::run(ConstImageView input, ImageView output, Gradients* gradients, bool withOrientation) {
     if (input.isEmpty() || output.isEmpty()) {
         return false;
     }
+    if (output.width() != input.width() || output.height() != input.height()) {
+        return false;
+    }
 
-    Image horizontalEdges(input.width(), input.height());
-    Image verticalEdges(input.width(), input.height());
+    const unsigned int width = input.width();
+    const unsigned int height = input.height();
+    const BorderMode mode = m_border.mode;
+    const unsigned char fill = mode == BorderMode::Constant ? m_border.value : 0;
+    // Stands in for the rows above and below the image with Zero and
+    // Constant. Per thread, so that one filter can run on several images
+    // at once
+    static thread_local std::vector<unsigned char> fillRow;
+    fillRow.assign(width, fill);
+    const unsigned char* outside = fillRow.data(); // the workers see their own fillRow, so pass the pointer
+    auto rowAt = [&](int y) {
+        int source = borderIndex(y, static_cast<int>(height), mode);
+        return source < 0 ? outside : input.row(source);
+    };
 
-    for (unsigned int y = 0; y < input.height(); y++) {
-        for (unsigned int x = 0; x < input.width(); x++) {
-            float sum = 0.0f;
-            for (int ky = -1; ky <= 1; ky++) {
-                for (int kx = -1; kx <= 1; kx++) {
-                    int px = x + kx;
-                    int py = y + ky;
-                    if (px >= 0 && px < static_cast<int>(input.width()) && py >= 0 && py < static_cast<int>(input.height())) {
-                        sum += input.at(px, py) * m_kernel[ky + 1][kx + 1];
-                    }
-                }
-            }
-            horizontalEdges.at(x, y) = static_cast<unsigned char>(std::abs(sum));
-        }
+    if (gradients) {
+        const size_t count = static_cast<size_t>(width) * height;
+        gradients->width = width;
+        gradients->height = height;
+        gradients->gx.resize(count);
+        gradients->gy.resize(count);
+        gradients->orientation.resize(withOrientation ? count : 0);
     }
 
-    for (unsigned int y = 0; y < input.height(); y++) {
-        for (unsigned int x = 0; x < input.width(); x++) {
-            float sum = 0.0f;
-            for (int ky = -1; ky <= 1; ky++) {
-                for (int kx = -1; kx <= 1; kx++) {
-                    int px = x + kx;
-                    int py = y + ky;
-                    if (px >= 0 && px < static_cast<int>(input.width()) && py >= 0 && py < static_cast<int>(input.height())) {
-                        sum += input.at(px, py) * m_verticalKernel[ky + 1][kx + 1];
-                    }
+    // Every row only reads its three input rows, so bands of rows run in
+    // parallel, each thread with its own scratch rows
+    ThreadPool::instance().parallelFor(height, 1, [&](unsigned int firstRow, unsigned int endRow) {
+        static thread_local std::vector<int16_t> smoothRow;     // top + 2 * middle + bottom, one column outside on each side
+        static thread_local std::vector<int16_t> differenceRow; // bottom - top, one column outside on each side
+        static thread_local std::vector<int16_t> gxScratch;     // one row of gradients when the caller wants none
+        static thread_local std::vector<int16_t> gyScratch;
+        smoothRow.assign(width + 2, 0);
+        differenceRow.assign(width + 2, 0);
+        if (!gradients) {
+            gxScratch.resize(width);
+            gyScratch.resize(width);
+        }
+        int16_t* smooth = smoothRow.data() + 1;
+        int16_t* difference = differenceRow.data() + 1;
+
+        for (unsigned int y = firstRow; y < endRow; y++) {
+            const unsigned char* top = rowAt(static_cast<int>(y) - 1);
+            const unsigned char* middle = input.row(y);
+            const unsigned char* bottom = rowAt(static_cast<int>(y) + 1);
+            for (unsigned int x = 0; x < width; x++) {
+                smooth[x] = static_cast<int16_t>(top[x] + 2 * middle[x] + bottom[x]);
+                difference[x] = static_cast<int16_t>(bottom[x] - top[x]);
+            }
+            // The two columns outside the image are the only ones that go
+            // through the border mode; a constant column has no vertical
+            // difference
+            for (int x : {-1, static_cast<int>(width)}) {
+                int source = borderIndex(x, static_cast<int>(width), mode);
+                smooth[x] = static_cast<int16_t>(source < 0 ? 4 * fill : smooth[source]);
+                difference[x] = static_cast<int16_t>(source < 0 ? 0 : difference[source]);
+            }
+
+            // Without a gradients output Gx and Gy go to one row of scratch
+            int16_t* gxRow = gradients ? gradients->gx.data() + static_cast<size_t>(y) * width : gxScratch.data();
+            int16_t* gyRow = gradients ? gradients->gy.data() + static_cast<size_t>(y) * width : gyScratch.data();
+            for (unsigned int x = 0; x < width; x++) {
+                gxRow[x] = static_cast<int16_t>(smooth[x + 1] - smooth[static_cast<int>(x) - 1]);
+                gyRow[x] = static_cast<int16_t>(difference[static_cast<int>(x) - 1] + 2 * difference[x] + difference[x + 1]);
+            }
+
+            // One loop per norm so that each one stays branch-free
+            unsigned char* dst = output.row(y);
+            switch (m_norm) {
+            case Norm::L1:
+                for (unsigned int x = 0; x < width; x++) {
+                    int magnitude = std::abs(gxRow[x]) + std::abs(gyRow[x]);
+                    dst[x] = static_cast<unsigned char>(std::min(255, magnitude));
+                }
+                break;
+            case Norm::Max:
+                for (unsigned int x = 0; x < width; x++) {
+                    int magnitude = std::max(std::abs(gxRow[x]), std::abs(gyRow[x]));
+                    dst[x] = static_cast<unsigned char>(std::min(255, magnitude));
                 }
+                break;
+            default:
+                // The float square root of an integer below 2^24 is correctly
+                // rounded and never reaches the next integer, so truncating it
+                // gives the exact integer square root
+                for (unsigned int x = 0; x < width; x++) {
+                    int squared = gxRow[x] * gxRow[x] + gyRow[x] * gyRow[x];
+                    float magnitude = std::min(255.0f, std::sqrt(static_cast<float>(squared)));
+                    dst[x] = static_cast<unsigned char>(magnitude);
+                }
+                break;
             }
-            verticalEdges.at(x, y) = static_cast<unsigned char>(std::abs(sum));
-        }
-    }
 
-    for (unsigned int y = 0; y < input.height(); y++) {
-        for (unsigned int x = 0; x < input.width(); x++) {
-            float h = horizontalEdges.at(x, y);
-            float v = verticalEdges.at(x, y);
-            float magnitude = std::sqrt(h * h + v * v);
-            output.at(x, y) = static_cast<unsigned char>(magnitude);
+            if (withOrientation && gradients) {
+                float* orientation = gradients->orientation.data() + static_cast<size_t>(y) * width;
+                for (unsigned int x = 0; x < width; x++) {
+                    orientation[x] = std::atan2(static_cast<float>(gyRow[x]), static_cast<float>(gxRow[x]));
+                }
+            }
         }
-    }
+    });
 
     return true;
-} 
\ No newline at end of file
+}
+
+// A pixel reads its 3x3 neighbourhood, and with Wrap the pixels at the
+// edges read the far side of the image
+unsigned int SobelFilter::halo() const {
+    return m_border.mode == BorderMode::Wrap ? kUnboundedHalo : 1;
+}
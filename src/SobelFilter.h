@@ -2,19 +2,72 @@
 #define SOBEL_FILTER_H
 
 #include "ImageProcessing.h"
+#include <cstdint>
+#include <vector>
 
+/**
+ * @brief Sobel edge magnitude in a single pass
+ *
+ * Gx and Gy are computed exactly in 16 bit from a sliding window of three
+ * rows and turned into a magnitude clamped to 255; only the magnitude is
+ * clamped. Pixels outside the image are read according to the border
+ * mode, zero by default.
+ */
 class SobelFilter : public ImageProcessing {
 public:
-    SobelFilter();
+    /**
+     * @brief How the magnitude is computed from Gx and Gy
+     */
+    enum class Norm {
+        L2,  // sqrt(Gx^2 + Gy^2), exact integer square root
+        L1,  // |Gx| + |Gy|
+        Max  // max(|Gx|, |Gy|)
+    };
+
+    /**
+     * @brief Gradients of the last processed image, row-major, width entries per row
+     */
+    struct Gradients {
+        unsigned int width = 0;
+        unsigned int height = 0;
+        std::vector<int16_t> gx;
+        std::vector<int16_t> gy;
+        std::vector<float> orientation; // atan2(Gy, Gx) in radians, only filled on request
+    };
+
+    /**
+     * @brief Constructor
+     * @param norm How the magnitude is computed
+     * @param border What the kernels read outside the image
+     */
+    SobelFilter(Norm norm = Norm::L2, Border border = Border());
     ~SobelFilter();
-    bool process(const Image& input, Image& output) override;
+
+    using ImageProcessing::process;
+
+    /**
+     * @brief One pixel, unbounded with BorderMode::Wrap
+     */
+    unsigned int halo() const override;
+
+    /**
+     * @brief Compute the magnitude and keep the gradients
+     * @param input Source image
+     * @param output Destination image, must have the size of input
+     * @param gradients Receives Gx, Gy and optionally the orientation; its
+     *                  vectors are only reallocated when the size changes
+     * @param withOrientation Also fill gradients.orientation
+     */
+    bool process(ConstImageView input, ImageView output, Gradients& gradients, bool withOrientation = false);
+
+protected:
+    bool doProcess(ConstImageView input, ImageView output) override;
 
 private:
-    float** m_kernel;
-    float** m_verticalKernel;
-    int m_kernelSize;
-    float m_factor;
-    float m_bias;
+    bool run(ConstImageView input, ImageView output, Gradients* gradients, bool withOrientation);
+
+    Norm m_norm;
+    Border m_border;
 };
 
-#endif // SOBEL_FILTER_H 
\ No newline at end of file
+#endif // SOBEL_FILTER_H
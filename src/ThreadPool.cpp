@@ -0,0 +1,165 @@
+#include "ThreadPool.h"
+#include "Instrumentation.h"
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+thread_local bool t_insideBand = false;
+
+// Marks the thread as running a band until the band returns or throws
+class BandScope {
+public:
+    BandScope() : m_previous(t_insideBand) { t_insideBand = true; }
+    ~BandScope() { t_insideBand = m_previous; }
+    BandScope(const BandScope&) = delete;
+    BandScope& operator=(const BandScope&) = delete;
+
+private:
+    bool m_previous;
+};
+
+} // namespace
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::ThreadPool()
+    : m_grainSize(16), m_stop(false), m_generation(0), m_pending(0),
+      m_task(nullptr), m_context(nullptr), m_rows(0), m_bandRows(0), m_bands(0), m_traceName("parallelFor") {
+    startWorkers(std::max(1u, std::thread::hardware_concurrency()) - 1);
+}
+
+ThreadPool::~ThreadPool() {
+    stopWorkers();
+}
+
+void ThreadPool::setThreadCount(unsigned int count) {
+    if (count == 0)
+        count = std::max(1u, std::thread::hardware_concurrency());
+    std::lock_guard<std::mutex> lock(m_runMutex);
+    if (count - 1 == m_workers.size())
+        return;
+    stopWorkers();
+    startWorkers(count - 1);
+}
+
+unsigned int ThreadPool::threadCount() const {
+    return static_cast<unsigned int>(m_workers.size()) + 1;
+}
+
+void ThreadPool::setGrainSize(unsigned int rows) {
+    m_grainSize = std::max(1u, rows);
+}
+
+unsigned int ThreadPool::grainSize() const {
+    return m_grainSize;
+}
+
+void ThreadPool::startWorkers(unsigned int count) {
+    m_stop = false;
+    for (unsigned int i = 0; i < count; i++) {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this, i + 1, m_generation);
+    }
+}
+
+void ThreadPool::stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& worker : m_workers) {
+        worker.join();
+    }
+    m_workers.clear();
+}
+
+void ThreadPool::runBand(unsigned int band) {
+    unsigned int first = band * m_bandRows;
+    unsigned int end = std::min(m_rows, first + m_bandRows);
+    if (first < end) {
+#ifdef IMAGE_INSTRUMENTATION
+        Instrumentation::TraceScope trace(m_traceName);
+#endif
+        BandScope scope;
+        try {
+            m_task(m_context, first, end);
+        } catch (...) {
+            // Kept for the calling thread, the first one wins
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_error)
+                m_error = std::current_exception();
+        }
+    }
+}
+
+// Worker i runs band i of every job that has that many bands. It starts
+// from the generation current when it was created, so it never picks up
+// a job that finished before it existed
+void ThreadPool::workerLoop(unsigned int index, uint64_t seen) {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+            if (m_stop)
+                return;
+            seen = m_generation;
+            if (index >= m_bands)
+                continue;
+        }
+
+        runBand(index);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_pending == 0)
+            m_done.notify_one();
+    }
+}
+
+void ThreadPool::run(unsigned int rows, unsigned int halo, Task task, void* context) {
+    runBands(rows, std::max(m_grainSize, 4 * halo), task, context);
+}
+
+void ThreadPool::runBands(unsigned int rows, unsigned int minBand, Task task, void* context) {
+    if (rows == 0)
+        return;
+
+    // Nested calls, e.g. a processor run by a Pipeline tile, stay on the
+    // thread of the enclosing band
+    const unsigned int bands = std::max(1u, std::min(threadCount(), rows / std::max(1u, minBand)));
+    if (bands == 1 || t_insideBand) {
+        task(context, 0, rows);
+        return;
+    }
+
+    std::lock_guard<std::mutex> runLock(m_runMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = task;
+        m_context = context;
+        m_rows = rows;
+        m_bandRows = (rows + bands - 1) / bands;
+        m_bands = bands;
+        m_pending = bands - 1;
+        m_generation++;
+#ifdef IMAGE_INSTRUMENTATION
+        const char* call = Instrumentation::currentCall();
+        m_traceName = call ? call : "parallelFor";
+#endif
+    }
+    m_wake.notify_all();
+
+    runBand(0);
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [&] { return m_pending == 0; });
+        std::swap(error, m_error);
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
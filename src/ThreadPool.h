@@ -0,0 +1,123 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief Persistent worker threads running row bands of an image in parallel
+ *
+ * parallelFor splits [0, rows) into at most threadCount() contiguous bands.
+ * The calling thread runs the first band and the workers the others; band
+ * i always goes to the same thread, so per-thread scratch buffers settle
+ * after the first call. Processors write each output row from the input
+ * alone, so the result does not depend on how the rows are split.
+ * A parallelFor called from inside a band runs on the calling thread.
+ * An exception thrown by a band is rethrown by parallelFor once every
+ * band has finished; when several throw, the first one caught is kept.
+ */
+class ThreadPool {
+public:
+    /**
+     * @brief Get the pool shared by all processors
+     */
+    static ThreadPool& instance();
+
+    ~ThreadPool();
+
+    /**
+     * @brief Set the number of threads, the calling thread included
+     * @param count Number of threads, 0 for std::thread::hardware_concurrency()
+     */
+    void setThreadCount(unsigned int count);
+
+    /**
+     * @brief Get the number of threads, the calling thread included
+     */
+    unsigned int threadCount() const;
+
+    /**
+     * @brief Set the minimum number of rows per band
+     * @param rows Minimum band height, at least 1
+     */
+    void setGrainSize(unsigned int rows);
+
+    /**
+     * @brief Get the minimum number of rows per band
+     */
+    unsigned int grainSize() const;
+
+    /**
+     * @brief Run fn(firstRow, endRow) over bands covering [0, rows) and wait for all of them
+     * Bands are at least grainSize() rows, and at least four times the halo
+     * so that rows re-read around each band stay a small part of the work.
+     * Small images run on the calling thread only.
+     * @param rows Number of rows
+     * @param halo Number of rows a band reads above and below its own
+     * @param fn Callable taking (unsigned int firstRow, unsigned int endRow)
+     */
+    template <typename Function>
+    void parallelFor(unsigned int rows, unsigned int halo, Function&& fn) {
+        using F = typename std::remove_reference<Function>::type;
+        run(rows, halo, &invoke<F>, const_cast<void*>(static_cast<const void*>(&fn)));
+    }
+
+    /**
+     * @brief Run fn(first, end) over independent items such as tiles and wait for all of them
+     * Unlike parallelFor there is no minimum band size, every thread gets
+     * items as soon as there are as many items as threads
+     * @param items Number of items
+     * @param fn Callable taking (unsigned int first, unsigned int end)
+     */
+    template <typename Function>
+    void parallelForItems(unsigned int items, Function&& fn) {
+        using F = typename std::remove_reference<Function>::type;
+        runBands(items, 1, &invoke<F>, const_cast<void*>(static_cast<const void*>(&fn)));
+    }
+
+private:
+    using Task = void (*)(void* context, unsigned int firstRow, unsigned int endRow);
+
+    template <typename F>
+    static void invoke(void* context, unsigned int firstRow, unsigned int endRow) {
+        (*static_cast<F*>(context))(firstRow, endRow);
+    }
+
+    ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void run(unsigned int rows, unsigned int halo, Task task, void* context);
+    void runBands(unsigned int rows, unsigned int minBand, Task task, void* context);
+    void runBand(unsigned int band);
+    void workerLoop(unsigned int index, uint64_t seen);
+    void startWorkers(unsigned int count);
+    void stopWorkers();
+
+    std::vector<std::thread> m_workers;
+    unsigned int m_grainSize;
+
+    std::mutex m_runMutex; // one parallelFor at a time
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    bool m_stop;
+    uint64_t m_generation;
+    unsigned int m_pending;
+
+    // Current job, written under m_mutex before the workers are woken
+    Task m_task;
+    void* m_context;
+    unsigned int m_rows;
+    unsigned int m_bandRows;
+    unsigned int m_bands;
+    const char* m_traceName; // call that started the job, for trace events of its bands
+    std::exception_ptr m_error; // first exception thrown by a band of the current job
+};
+
+#endif // THREAD_POOL_H
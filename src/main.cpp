@@ -2,18 +2,266 @@
 #include "SobelFilter.h"
 #include "BrightnessContrast.h"
 #include "GammaCorrection.h"
+#include "PointOp.h"
 #include "MeanBlur.h"
 #include "GaussianBlur.h"
+#include "RecursiveGaussianBlur.h"
+#include "Convolution.h"
 #include "Drawing.h"
+#include "SimdArithmetic.h"
+#include "ThreadPool.h"
+#include "Pipeline.h"
+#include "PgmStream.h"
+#include "Batch.h"
+#include "FrameStream.h"
+#include "Instrumentation.h"
+#include "IntegralImage.h"
 #include <iostream>
 #include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <utility>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#ifdef __linux__
+#include <csignal>
+#include <sys/resource.h>
+#endif
+
+// Count heap allocations so that processing loops can be checked to run
+// without touching the heap once their buffers exist
+namespace {
+std::atomic<size_t> g_allocations(0); // the stream test allocates from several threads
+}
+
+void* operator new(std::size_t size) {
+    ++g_allocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    ++g_allocations;
+    size_t align = static_cast<size_t>(alignment);
+    if (void* p = std::aligned_alloc(align, (size + align - 1) / align * align))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+// Check that two images have the same pixels
+bool samePixels(const Image& a, const Image& b) {
+    if (a.width() != b.width() || a.height() != b.height())
+        return false;
+    for (unsigned int y = 0; y < a.height(); y++) {
+        if (!std::equal(a.row(y), a.row(y) + a.width(), b.row(y)))
+            return false;
+    }
+    return true;
+}
+
+// Image grown by margin pixels on each side, filled the way a border mode
+// reads outside the image, for checking border modes against zero padding
+Image padImage(const Image& image, unsigned int margin, Border border) {
+    const int width = static_cast<int>(image.width()), height = static_cast<int>(image.height());
+    auto map = [&](int i, int size) {
+        switch (border.mode) {
+        case BorderMode::Replicate:
+            return std::min(std::max(i, 0), size - 1);
+        case BorderMode::Reflect:
+            while (size > 1 && (i < 0 || i >= size))
+                i = i < 0 ? -i : 2 * (size - 1) - i;
+            return size > 1 ? i : 0;
+        case BorderMode::Wrap:
+            return (i % size + size) % size;
+        default:
+            return i >= 0 && i < size ? i : -1;
+        }
+    };
+    Image padded(image.width() + 2 * margin, image.height() + 2 * margin);
+    for (int y = 0; y < static_cast<int>(padded.height()); y++) {
+        for (int x = 0; x < static_cast<int>(padded.width()); x++) {
+            int sx = map(x - static_cast<int>(margin), width), sy = map(y - static_cast<int>(margin), height);
+            padded.row(y)[x] = sx < 0 || sy < 0 ? border.value : image.row(sy)[sx];
+        }
+    }
+    return padded;
+}
+
+// Time each processor from one thread up to the hardware thread count
+void printScalingReport(const Image& img, const std::vector<std::pair<const char*, ImageProcessing*>>& processors) {
+    ThreadPool& pool = ThreadPool::instance();
+    const unsigned int previous = pool.threadCount();
+    const unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    Image output(img.width(), img.height());
+
+    std::cout << "Scaling on " << img.width() << "x" << img.height() << ", best of 5 runs, ms (speedup)" << std::endl;
+    for (const auto& entry : processors) {
+        std::cout << entry.first;
+        double single = 0.0;
+        for (unsigned int threads = 1; threads <= maxThreads; threads *= 2) {
+            pool.setThreadCount(threads);
+            double best = 1e30;
+            for (int run = 0; run < 5; run++) {
+                auto start = std::chrono::steady_clock::now();
+                entry.second->process(img, output);
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                best = std::min(best, elapsed.count());
+            }
+            if (threads == 1)
+                single = best;
+            std::cout << "  " << threads << "t: " << best << " (" << single / best << "x)";
+            if (threads < maxThreads && threads * 2 > maxThreads)
+                threads = maxThreads / 2; // end on the full thread count
+        }
+        std::cout << std::endl;
+    }
+    pool.setThreadCount(previous);
+}
+
+// Batch mode: --batch <operations> <output_dir> [--workers N] [--queue N] <inputs...>
+int runBatchCommand(int argc, char** argv) {
+    if (argc < 5) {
+        std::cerr << "Usage: " << argv[0] << " --batch <operations> <output_dir> [--workers N] [--queue N] <inputs...>\n"
+                  << "  operations: comma-separated sobel[:l2|l1|max], gamma:G, bc:FACTOR:BIAS, mean:SIZE,\n"
+                  << "              gaussian:SIZE:SIGMA, recursive:SIGMA, sharpen\n"
+                  << "  inputs: files, directories, glob patterns or @file_list" << std::endl;
+        return 1;
+    }
+
+    BatchOptions options;
+    options.operations = argv[2];
+    options.outputDir = argv[3];
+    try {
+        for (int i = 4; i < argc; i++) {
+            const std::string argument = argv[i];
+            if ((argument == "--workers" || argument == "--queue") && i + 1 < argc) {
+                unsigned int value = static_cast<unsigned int>(std::stoul(argv[++i]));
+                (argument == "--workers" ? options.workers : options.queueDepth) = value;
+            } else {
+                options.inputs.push_back(argument);
+            }
+        }
+        return runBatch(options) == 0 ? 0 : 2;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
+
+// Stream mode: --stream <operations> [--ring N], frames from stdin to stdout
+int runStreamCommand(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " --stream <operations> [--ring N] < frames.pgm > processed.pgm" << std::endl;
+        return 1;
+    }
+    try {
+        ProcessorChain chain(argv[2]);
+        unsigned int ringSize = 3;
+        if (argc == 5 && std::string(argv[3]) == "--ring")
+            ringSize = static_cast<unsigned int>(std::stoul(argv[4]));
+        StreamStats stats = runStream(chain.processor(), 0, 1, ringSize);
+        std::cerr << stats.frames << " frames in " << stats.seconds << " s, "
+                  << (stats.seconds > 0.0 ? stats.frames / stats.seconds : 0.0) << " frames/s, latency p50 "
+                  << stats.latency.percentile(0.5) / 1000.0 << " ms, p99 " << stats.latency.percentile(0.99) / 1000.0
+                  << " ms, max " << stats.latency.max() / 1000.0 << " ms" << std::endl;
+        return stats.failed ? 2 : 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <input_image.pgm>" << std::endl;
+    if (argc > 1 && std::string(argv[1]) == "--batch") {
+        return runBatchCommand(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--stream") {
+        return runStreamCommand(argc, argv);
+    }
+
+    bool scaling = argc == 3 && std::string(argv[2]) == "--scaling";
+    if (argc != 2 && !scaling) {
+        std::cerr << "Usage: " << argv[0] << " <input_image.pgm> [--scaling]\n"
+                  << "       " << argv[0] << " --batch <operations> <output_dir> [--workers N] [--queue N] <inputs...>\n"
+                  << "       " << argv[0] << " --stream <operations> [--ring N]" << std::endl;
         return 1;
     }
 
+    // Every SIMD variant this CPU supports must match the scalar kernels,
+    // over all byte pairs and over lengths that leave every tail size
+    {
+        using namespace SimdArithmetic;
+        std::vector<unsigned char> a(65536 + 127), b(a.size());
+        for (size_t i = 0; i < a.size(); i++) {
+            a[i] = static_cast<unsigned char>(i);
+            b[i] = static_cast<unsigned char>(i >> 8 ^ i * 7);
+        }
+        std::vector<unsigned char> expected(a.size()), actual(a.size());
+        const Kernels& scalar = *kernels(Isa::Scalar);
+        std::vector<unsigned char> table(256);
+        for (size_t i = 0; i < table.size(); i++) {
+            table[i] = static_cast<unsigned char>(i * 167 + 91);
+        }
+        scalar.lookup(a.data(), table.data(), expected.data(), 256);
+        for (size_t i = 0; i < 256; i++) {
+            assert(expected[i] == table[i]);
+        }
+        for (Isa isa : {Isa::SSE2, Isa::SSSE3, Isa::AVX2, Isa::AVX512BW, Isa::AVX512VBMI}) {
+            const Kernels* simd = kernels(isa);
+            if (!simd)
+                continue;
+            for (size_t count : {size_t(0), size_t(1), size_t(15), size_t(33), size_t(127), a.size()}) {
+                scalar.add(a.data(), b.data(), expected.data(), count);
+                simd->add(a.data(), b.data(), actual.data(), count);
+                assert(std::equal(expected.begin(), expected.begin() + count, actual.begin()));
+                scalar.subtract(a.data(), b.data(), expected.data(), count);
+                simd->subtract(a.data(), b.data(), actual.data(), count);
+                assert(std::equal(expected.begin(), expected.begin() + count, actual.begin()));
+                scalar.multiply(a.data(), b.data(), expected.data(), count);
+                simd->multiply(a.data(), b.data(), actual.data(), count);
+                assert(std::equal(expected.begin(), expected.begin() + count, actual.begin()));
+                for (int scalarValue : {0, 1, 100, 255}) {
+                    unsigned char v = static_cast<unsigned char>(scalarValue);
+                    scalar.addScalar(a.data(), v, expected.data(), count);
+                    simd->addScalar(a.data(), v, actual.data(), count);
+                    assert(std::equal(expected.begin(), expected.begin() + count, actual.begin()));
+                    scalar.subtractScalar(a.data(), v, expected.data(), count);
+                    simd->subtractScalar(a.data(), v, actual.data(), count);
+                    assert(std::equal(expected.begin(), expected.begin() + count, actual.begin()));
+                }
+                scalar.lookup(a.data(), table.data(), expected.data(), count);
+                simd->lookup(a.data(), table.data(), actual.data(), count);
+                assert(std::equal(expected.begin(), expected.begin() + count, actual.begin()));
+            }
+            // Every tail length up to two AVX-512 vectors, starting at every byte value
+            for (size_t count = 0; count <= 64 + 63; count++) {
+                for (size_t offset = 0; offset < 256; offset++) {
+                    scalar.lookup(a.data() + offset, table.data(), expected.data(), count);
+                    simd->lookup(a.data() + offset, table.data(), actual.data(), count);
+                    assert(std::equal(expected.begin(), expected.begin() + count, actual.begin()));
+                }
+            }
+        }
+        std::cout << "Arithmetic kernels: " << best().name << std::endl;
+    }
+
     Image img;
     if (!img.load(argv[1])) {
         std::cerr << "Error loading image: " << argv[1] << std::endl;
@@ -32,6 +280,13 @@ int main(int argc, char** argv) {
     assert(!processed.isEmpty());
     processed.save("sobel_edges.pgm");
 
+    // The gradients come out unclamped, 16 bit
+    SobelFilter::Gradients gradients;
+    bool gradients_ok = sobel.process(img, processed, gradients, true);
+    assert(gradients_ok);
+    assert(gradients.gx.size() == static_cast<size_t>(img.width()) * img.height());
+    assert(gradients.orientation.size() == gradients.gx.size());
+
     BrightnessContrast bc(1.5f, 30.0f);
     bool bc_ok = bc.process(img, processed);
     assert(bc_ok);
@@ -48,6 +303,52 @@ int main(int argc, char** argv) {
     assert(!processed.isEmpty());
     processed.save("gamma_correction.pgm");
 
+    // Gamma, then brightness/contrast, then a scalar add fuse into one table
+    // and one pass, with the same result as three passes
+    PointOp fused = gc.then(bc).then(PointOp::add(20));
+    Image stepwise = img;
+    gc.process(stepwise, stepwise);
+    bc.process(stepwise, stepwise);
+    stepwise = stepwise + static_cast<unsigned char>(20);
+    bool fused_ok = fused.process(img, processed);
+    assert(fused_ok);
+    for (unsigned int y = 0; y < img.height(); y++) {
+        for (unsigned int x = 0; x < img.width(); x++) {
+            assert(processed.at(x, y) == stepwise.at(x, y));
+        }
+    }
+    processed.save("fused_point_ops.pgm");
+
+    // A blend expression evaluates in one pass into one new image, with the
+    // same saturation at every step as evaluating one operation at a time
+    Image blurred(img.width(), img.height());
+    GaussianBlur(5, 1.0f).process(img, blurred);
+    Image halfSum = img + blurred;
+    halfSum = halfSum * 0.5f;
+    Image blendStepwise = halfSum - stepwise;
+    blendStepwise = blendStepwise + static_cast<unsigned char>(10);
+    size_t blendAllocations = g_allocations;
+    Image blend = (img + blurred) * 0.5f - stepwise + 10;
+    assert(g_allocations == blendAllocations + 1);
+    for (unsigned int y = 0; y < img.height(); y++) {
+        for (unsigned int x = 0; x < img.width(); x++) {
+            assert(blend.at(x, y) == blendStepwise.at(x, y));
+        }
+    }
+
+    // Multiplying by a constant goes through a table, alone or inside a
+    // tree, with the products of the per-pixel arithmetic
+    for (float factor : {0.0f, 0.37f, 0.5f, 1.0f, 1.9f, 3.0f}) {
+        Image scaled = img * factor;
+        Image scaledSum = (img + blurred) * factor;
+        for (unsigned int y = 0; y < img.height(); y++) {
+            for (unsigned int x = 0; x < img.width(); x++) {
+                assert(scaled.at(x, y) == MultiplyScalarOp::apply(img.at(x, y), factor));
+                assert(scaledSum.at(x, y) == MultiplyScalarOp::apply(AddOp::apply(img.at(x, y), blurred.at(x, y)), factor));
+            }
+        }
+    }
+
     MeanBlur meanBlur(5);
     bool mean_ok = meanBlur.process(img, processed);
     assert(mean_ok);
@@ -56,6 +357,88 @@ int main(int argc, char** argv) {
     assert(!processed.isEmpty());
     processed.save("mean_blur.pgm");
 
+    // The mean of the pixels of the window inside the image, the edges
+    // averaging fewer pixels, matches the original float loop exactly, also
+    // for windows larger than the image
+    {
+        Image crop;
+        img.getROI(crop, 50, 40, 61, 37);
+        for (int size : {1, 3, 5, 9, 41, 81}) {
+            Image blurredCrop;
+            bool crop_ok = MeanBlur(size).process(crop, blurredCrop);
+            assert(crop_ok);
+            const int radius = size / 2, width = static_cast<int>(crop.width()), height = static_cast<int>(crop.height());
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    float sum = 0.0f;
+                    int count = 0;
+                    for (int py = std::max(0, y - radius); py <= std::min(height - 1, y + radius); py++) {
+                        for (int px = std::max(0, x - radius); px <= std::min(width - 1, x + radius); px++) {
+                            sum += crop.at(px, py);
+                            count++;
+                        }
+                    }
+                    assert(blurredCrop.at(x, y) == static_cast<unsigned char>(sum / count));
+                }
+            }
+        }
+    }
+
+    // The separable fixed-point blur stays within one level of the original
+    // normalized 2D float kernel, zero outside the image, borders included
+    {
+        Image crop;
+        img.getROI(crop, 50, 40, 61, 37);
+        const std::pair<int, float> parameters[] = {{3, 0.5f}, {5, 1.0f}, {7, 1.5f}, {9, 2.0f}, {15, 3.0f}, {31, 5.0f}};
+        for (const auto& parameter : parameters) {
+            const int size = parameter.first, radius = size / 2;
+            const float sigma = parameter.second;
+            std::vector<float> kernel(size * size);
+            float kernelSum = 0.0f;
+            for (int y = -radius; y <= radius; y++) {
+                for (int x = -radius; x <= radius; x++) {
+                    kernel[(y + radius) * size + x + radius] = std::exp(-(x * x + y * y) / (2 * sigma * sigma));
+                    kernelSum += kernel[(y + radius) * size + x + radius];
+                }
+            }
+            for (float& tap : kernel) {
+                tap /= kernelSum;
+            }
+
+            Image blurredCrop;
+            bool crop_ok = GaussianBlur(size, sigma).process(crop, blurredCrop);
+            assert(crop_ok);
+            const int width = static_cast<int>(crop.width()), height = static_cast<int>(crop.height());
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    float sum = 0.0f;
+                    for (int ky = -radius; ky <= radius; ky++) {
+                        for (int kx = -radius; kx <= radius; kx++) {
+                            if (x + kx >= 0 && x + kx < width && y + ky >= 0 && y + ky < height)
+                                sum += crop.at(x + kx, y + ky) * kernel[(ky + radius) * size + kx + radius];
+                        }
+                    }
+                    assert(std::abs(blurredCrop.at(x, y) - static_cast<int>(static_cast<unsigned char>(sum))) <= 1);
+                }
+            }
+        }
+    }
+
+    // Blurs with the parameters of a recent one share its kernel; once
+    // enough other parameters were used it is built again
+    {
+        GaussianBlur(7, 1.5f);
+        size_t kernelAllocations = g_allocations;
+        GaussianBlur(7, 1.5f);
+        assert(g_allocations == kernelAllocations);
+        for (int i = 0; i < 16; i++) {
+            GaussianBlur(7, 2.0f + i);
+        }
+        kernelAllocations = g_allocations;
+        GaussianBlur(7, 1.5f);
+        assert(g_allocations > kernelAllocations);
+    }
+
     GaussianBlur gaussianBlur(5, 1.0f);
     bool gauss_ok = gaussianBlur.process(img, processed);
     assert(gauss_ok);
@@ -64,6 +447,651 @@ int main(int argc, char** argv) {
     assert(!processed.isEmpty());
     processed.save("gaussian_blur.pgm");
 
+    // Blur only the center of the image, writing straight into it
+    Rectangle center(img.width() / 4, img.height() / 4, img.width() / 2, img.height() / 2);
+    processed = img;
+    bool roi_ok = gaussianBlur.process(img.getROI(center), processed.getROI(center));
+    assert(roi_ok);
+    assert(img.getROI(Rectangle(0, 0, img.width() + 1, 1)).isEmpty());
+    processed.save("gaussian_blur_roi.pgm");
+
+    // Same-sized frames reuse the output and scratch buffers: after one
+    // warm-up pass the processors must not allocate
+    RecursiveGaussianBlur recursiveBlur(4.0f);
+    Convolution sharpen({{0, -1, 0}, {-1, 5, -1}, {0, -1, 0}});
+    std::vector<ImageProcessing*> processors = {
+        &sobel, &bc, &gc, &meanBlur, &gaussianBlur, &recursiveBlur, &sharpen};
+    Image frame;
+    for (ImageProcessing* processor : processors) {
+        bool warm_ok = processor->process(img, frame);
+        assert(warm_ok);
+    }
+    size_t allocations = g_allocations;
+    for (int i = 0; i < 3; i++) {
+        for (ImageProcessing* processor : processors) {
+            processor->process(img, frame);
+        }
+    }
+    assert(g_allocations == allocations);
+
+    // Splitting the rows over threads must not change any result. Bands of
+    // a single row on seven threads give the most band edges
+    {
+        ThreadPool& pool = ThreadPool::instance();
+        const unsigned int threads = pool.threadCount();
+        const unsigned int grain = pool.grainSize();
+        for (ImageProcessing* processor : processors) {
+            if (processor == &recursiveBlur)
+                continue; // runs on one thread
+            Image single, banded;
+            pool.setThreadCount(1);
+            processor->process(img, single);
+            pool.setThreadCount(7);
+            pool.setGrainSize(1);
+            processor->process(img, banded);
+            pool.setGrainSize(grain);
+            assert(samePixels(single, banded));
+        }
+        pool.setThreadCount(threads);
+    }
+
+    // An exception in any band reaches the caller after all bands are done,
+    // and leaves the pool able to run bands on all of its threads
+    {
+        ThreadPool& pool = ThreadPool::instance();
+        const unsigned int threads = pool.threadCount();
+        pool.setThreadCount(4);
+        for (unsigned int throwingBand : {0u, 3u}) {
+            std::atomic<unsigned int> finished(0);
+            bool caught = false;
+            try {
+                pool.parallelForItems(4, [&](unsigned int first, unsigned int) {
+                    if (first == throwingBand)
+                        throw std::runtime_error("band failed");
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                    ++finished;
+                });
+            } catch (const std::runtime_error&) {
+                caught = true;
+            }
+            assert(caught);
+            assert(finished == 3);
+
+            std::mutex idsMutex;
+            std::vector<std::thread::id> ids;
+            pool.parallelForItems(4, [&](unsigned int, unsigned int) {
+                std::lock_guard<std::mutex> lock(idsMutex);
+                ids.push_back(std::this_thread::get_id());
+            });
+            std::sort(ids.begin(), ids.end());
+            assert(std::unique(ids.begin(), ids.end()) - ids.begin() == 4);
+        }
+        pool.setThreadCount(threads);
+    }
+
+    // A tiled chain gives the same pixels as running the stages one by one,
+    // also with small odd tiles spread over several threads
+    {
+        Pipeline chain{&gaussianBlur, &sobel, &meanBlur, &sharpen, &bc};
+        Image stepA, stepB;
+        gaussianBlur.process(img, stepA);
+        sobel.process(stepA, stepB);
+        meanBlur.process(stepB, stepA);
+        sharpen.process(stepA, stepB);
+        bc.process(stepB, stepA);
+
+        Image tiled;
+        bool chain_ok = chain.process(img, tiled);
+        assert(chain_ok);
+        assert(samePixels(tiled, stepA));
+
+        ThreadPool& pool = ThreadPool::instance();
+        const unsigned int threads = pool.threadCount();
+        pool.setThreadCount(7);
+        chain.setTileSize(37, 23);
+        chain.process(img, tiled);
+        assert(samePixels(tiled, stepA));
+        pool.setThreadCount(threads);
+        tiled.save("pipeline.pgm");
+
+        Pipeline withRecursive{&gaussianBlur, &recursiveBlur, &bc};
+        assert(withRecursive.halo() == ImageProcessing::kUnboundedHalo);
+        gaussianBlur.process(img, stepA);
+        recursiveBlur.process(stepA, stepB);
+        bc.process(stepB, stepA);
+        withRecursive.process(img, tiled);
+        assert(samePixels(tiled, stepA));
+    }
+
+    // Processing a region gives the pixels of a full run inside it and
+    // leaves the rest of the output alone, also where it touches the borders
+    {
+        const unsigned int w = img.width(), h = img.height();
+        const std::vector<Rectangle> regions = {
+            Rectangle(w / 3, h / 4, w / 5, h / 7), Rectangle(0, 0, 17, 9), Rectangle(w - 5, h - 30, 5, 30),
+            Rectangle(w / 2, 0, 1, h), Rectangle(3, h / 2, 1, 1), Rectangle(0, 0, w, h)};
+        Pipeline chain{&gaussianBlur, &sobel, &meanBlur, &sharpen, &bc};
+        for (ImageProcessing* processor : std::vector<ImageProcessing*>{
+                 &sobel, &bc, &gc, &meanBlur, &gaussianBlur, &recursiveBlur, &sharpen, &chain}) {
+            Image full;
+            processor->process(img, full);
+            for (const Rectangle& roi : regions) {
+                Image expected(img), partial(img);
+                ConstImageView source = full.getROI(roi);
+                ImageView target = expected.getROI(roi);
+                for (unsigned int y = 0; y < roi.height; y++) {
+                    std::copy(source.row(y), source.row(y) + roi.width, target.row(y));
+                }
+                bool roi_ok = processor->process(img, partial, roi);
+                assert(roi_ok);
+                assert(samePixels(partial, expected));
+            }
+        }
+        Image partial(img);
+        assert(!sobel.process(img, partial, Rectangle(w - 4, 0, 5, 1)));
+        assert(!sobel.process(img, partial, Rectangle(0, 0, 0, 0)));
+    }
+
+    // Every border mode gives the pixels of zero padding run on the image
+    // padded by that mode, also on images smaller than the kernel; the
+    // local modes keep tiles and regions exact, Wrap makes the halo unbounded
+    {
+        Image tiny(5, 4);
+        for (unsigned int y = 0; y < tiny.height(); y++) {
+            for (unsigned int x = 0; x < tiny.width(); x++) {
+                tiny.row(y)[x] = static_cast<unsigned char>(x * 50 + y * 17);
+            }
+        }
+        const std::vector<std::vector<float>> kernel = {
+            {0, -1, 0, 1, 0}, {-1, 2, 1, 0, 1}, {0, 1, 1, 1, 0}, {1, 0, 1, 2, -1}, {0, 1, 0, -1, 0}};
+        for (Border border : {Border(BorderMode::Constant, 200), Border(BorderMode::Replicate),
+                              Border(BorderMode::Reflect), Border(BorderMode::Wrap)}) {
+            Convolution convolution(kernel, border);
+            GaussianBlur gaussian(9, 2.0f, border);
+            MeanBlur mean(7, border);
+            SobelFilter edges(SobelFilter::Norm::L1, border);
+            Convolution zeroConvolution(kernel);
+            GaussianBlur zeroGaussian(9, 2.0f);
+            MeanBlur fullMean(7, BorderMode::Constant);
+            SobelFilter zeroEdges(SobelFilter::Norm::L1);
+            const std::vector<std::pair<ImageProcessing*, ImageProcessing*>> pairs = {
+                {&convolution, &zeroConvolution}, {&gaussian, &zeroGaussian}, {&mean, &fullMean}, {&edges, &zeroEdges}};
+            for (const Image* source : {&img, &tiny}) {
+                for (const auto& pair : pairs) {
+                    const unsigned int margin = pair.second->halo();
+                    Image result, paddedResult;
+                    pair.first->process(*source, result);
+                    pair.second->process(padImage(*source, margin, border), paddedResult);
+                    Image expected;
+                    paddedResult.getROI(expected, Rectangle(margin, margin, source->width(), source->height()));
+                    assert(samePixels(result, expected));
+                }
+            }
+
+            if (border.mode == BorderMode::Wrap) {
+                assert(gaussian.halo() == ImageProcessing::kUnboundedHalo);
+                assert(edges.halo() == ImageProcessing::kUnboundedHalo);
+            }
+            Pipeline chain{&gaussian, &edges, &mean, &convolution};
+            chain.setTileSize(37, 23);
+            Image stepA, stepB, tiled, partial(img), full;
+            gaussian.process(img, stepA);
+            edges.process(stepA, stepB);
+            mean.process(stepB, stepA);
+            convolution.process(stepA, full);
+            chain.process(img, tiled);
+            assert(samePixels(tiled, full));
+            const Rectangle roi(img.width() - 40, 0, 40, 30);
+            chain.process(img, partial, roi);
+            Image expected, region;
+            full.getROI(expected, roi);
+            partial.getROI(region, roi);
+            assert(samePixels(region, expected));
+        }
+    }
+
+    // The unrolled fixed-size kernels, constant ones included, give the
+    // same bits as the generic loop, run here on the kernel zero-padded to 9x9
+    {
+        auto padded = [](const float* taps, int size) {
+            std::vector<std::vector<float>> rows(9, std::vector<float>(9, 0.0f));
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    rows[y + 4 - size / 2][x + 4 - size / 2] = taps[y * size + x];
+                }
+            }
+            return rows;
+        };
+        std::vector<std::pair<Convolution, std::vector<std::vector<float>>>> cases;
+        for (const FixedKernel<3>* kernel : {&FixedKernels::kSobelX, &FixedKernels::kSobelY, &FixedKernels::kLaplacian,
+                                             &FixedKernels::kSharpen, &FixedKernels::kBox3, &FixedKernels::kGaussian3}) {
+            cases.emplace_back(Convolution(*kernel), padded(kernel->taps, 3));
+        }
+        for (const FixedKernel<5>* kernel : {&FixedKernels::kBox5, &FixedKernels::kGaussian5}) {
+            cases.emplace_back(Convolution(*kernel), padded(kernel->taps, 5));
+        }
+        for (const FixedKernel<7>* kernel : {&FixedKernels::kBox7, &FixedKernels::kGaussian7}) {
+            cases.emplace_back(Convolution(*kernel), padded(kernel->taps, 7));
+        }
+        for (int size : {3, 5, 7}) {
+            std::vector<float> taps(size * size);
+            for (int i = 0; i < size * size; i++) {
+                taps[i] = static_cast<float>(i % 7) * 0.05f - 0.1f;
+            }
+            std::vector<std::vector<float>> kernel;
+            for (int y = 0; y < size; y++) {
+                kernel.emplace_back(taps.begin() + y * size, taps.begin() + (y + 1) * size);
+            }
+            cases.emplace_back(Convolution(kernel), padded(taps.data(), size));
+        }
+        assert(FixedKernels::kGaussian5.at(2, 2) == 36.0f / 256 && FixedKernels::kBox7.at(6, 0) == 1.0f / 49);
+
+        for (auto& entry : cases) {
+            assert(!entry.first.usesFft());
+            Convolution generic(entry.second);
+            generic.setMethod(Convolution::Method::Direct);
+            Image fixed, expected;
+            entry.first.process(img, fixed);
+            generic.process(img, expected);
+            assert(samePixels(fixed, expected));
+        }
+    }
+
+    // The FFT path matches the direct one up to float rounding, which can
+    // move a pixel by one level, for every border mode and for kernels
+    // larger than the image; automatic selection follows the kernel size
+    {
+        Image crop;
+        img.getROI(crop, Rectangle(37, 21, 110, 73));
+        Image tiny(9, 6);
+        for (unsigned int y = 0; y < tiny.height(); y++) {
+            for (unsigned int x = 0; x < tiny.width(); x++) {
+                tiny.row(y)[x] = static_cast<unsigned char>(255 - x * 20 - y * 9);
+            }
+        }
+        for (int size : {7, 25}) {
+            std::vector<std::vector<float>> kernel(size, std::vector<float>(size));
+            float total = 0.0f;
+            for (int ky = 0; ky < size; ky++) {
+                for (int kx = 0; kx < size; kx++) {
+                    kernel[ky][kx] = 1.0f + static_cast<float>((ky * 7 + kx * 3) % 5) - (kx == size / 2 ? 3.0f : 0.0f);
+                    total += kernel[ky][kx];
+                }
+            }
+            for (std::vector<float>& row : kernel) {
+                for (float& value : row) value = value / total * 1.3f;
+            }
+
+            for (Border border : {Border(), Border(BorderMode::Constant, 90), Border(BorderMode::Replicate),
+                                  Border(BorderMode::Reflect), Border(BorderMode::Wrap)}) {
+                Convolution fft(kernel, border), direct(kernel, border);
+                assert(fft.usesFft() == (size >= Convolution::kFftMinKernelSize));
+                fft.setMethod(Convolution::Method::Fft);
+                direct.setMethod(Convolution::Method::Direct);
+                assert(fft.usesFft() && !direct.usesFft());
+                for (const Image* source : {&crop, &tiny}) {
+                    Image expected, actual;
+                    direct.process(*source, expected);
+                    fft.process(*source, actual);
+                    int worst = 0;
+                    for (unsigned int y = 0; y < expected.height(); y++) {
+                        for (unsigned int x = 0; x < expected.width(); x++) {
+                            worst = std::max(worst, std::abs(expected.row(y)[x] - actual.row(y)[x]));
+                        }
+                    }
+                    assert(worst <= 1);
+                }
+            }
+        }
+    }
+
+    // Rectangle sums and sums of squares match a brute-force sum over the
+    // region, along the edges too, whatever the number of threads building
+    // the tables; past 2^32 / 255 pixels both tables are 64 bit
+    {
+        auto bruteForce = [](const Image& image, const Rectangle& rect, bool squared) {
+            ConstImageView roi = image.getROI(rect);
+            uint64_t total = 0;
+            for (unsigned int y = 0; y < roi.height(); y++) {
+                for (unsigned int x = 0; x < roi.width(); x++) {
+                    uint64_t value = roi.row(y)[x];
+                    total += squared ? value * value : value;
+                }
+            }
+            return total;
+        };
+        auto checkSums = [&](const Image& image, const IntegralImage& integral, const std::vector<Rectangle>& rects) {
+            for (const Rectangle& rect : rects) {
+                assert(integral.sum(rect) == bruteForce(image, rect, false));
+                assert(integral.squaredSum(rect) == bruteForce(image, rect, true));
+            }
+        };
+
+        ThreadPool& pool = ThreadPool::instance();
+        const unsigned int threads = pool.threadCount();
+        Image small(5, 3);
+        for (unsigned int y = 0; y < small.height(); y++) {
+            for (unsigned int x = 0; x < small.width(); x++) {
+                small.row(y)[x] = static_cast<unsigned char>(250 - 17 * x - 41 * y);
+            }
+        }
+        for (const Image* image : {&small, &img}) {
+            const unsigned int w = image->width(), h = image->height();
+            const std::vector<Rectangle> rects = {
+                {0, 0, w, h}, {0, 0, 1, 1}, {w - 1, h - 1, 1, 1}, {w - 1, 0, 1, 1}, {0, h - 1, 1, 1},
+                {0, 0, w, 1}, {0, 0, 1, h}, {0, h / 2, w, h - h / 2}, {w / 2, 0, w - w / 2, h},
+                {1, 1, w - 2, h - 2}, {w / 3, h / 3, w / 3, h / 3}, {2, 1, 0, 0}};
+            for (unsigned int count : {1u, 3u}) {
+                pool.setThreadCount(count);
+                IntegralImage integral(*image);
+                assert(integral.width() == w && integral.height() == h);
+                checkSums(*image, integral, rects);
+            }
+        }
+        pool.setThreadCount(threads);
+
+        IntegralImage smallIntegral(small);
+        assert(smallIntegral.mean(Rectangle(0, 0, 1, 1)) == small.row(0)[0]);
+        assert(smallIntegral.variance(Rectangle(2, 1, 1, 1)) == 0.0);
+
+        // 4200 x 4011 pixels of mostly 255 overflow 32 bits in both tables
+        Image large(4200, 4011);
+        for (unsigned int y = 0; y < large.height(); y++) {
+            unsigned char* row = large.row(y);
+            std::fill(row, row + large.width(), 255);
+            row[(y * 131) % large.width()] = static_cast<unsigned char>(y);
+        }
+        IntegralImage largeIntegral(large);
+        const Rectangle whole(0, 0, large.width(), large.height());
+        assert(largeIntegral.sum(whole) > std::numeric_limits<uint32_t>::max());
+        checkSums(large, largeIntegral, {whole, {0, 0, 1, 1}, {4199, 4010, 1, 1}, {0, 3900, 4200, 111},
+                                         {4100, 0, 100, 4011}, {1234, 2345, 300, 200}});
+    }
+
+    if (scaling) {
+        printScalingReport(img, {{"sobel", &sobel}, {"brightness/contrast", &bc}, {"gamma", &gc},
+                                 {"mean blur", &meanBlur}, {"gaussian blur", &gaussianBlur}, {"convolution", &sharpen}});
+    }
+
+    // Moving an image hands over its buffer
+    const unsigned char* frameData = frame.data();
+    Image moved(std::move(frame));
+    assert(moved.data() == frameData);
+    assert(frame.isEmpty());
+
+    // Detaching hands over the buffer with the deleter that frees it; a
+    // borrowed buffer is never freed
+    {
+        bool freed = false;
+        unsigned char* pixels = new unsigned char[64];
+        Image owned(pixels, 8, 8, 8, [&](unsigned char* data) { freed = true; delete[] data; });
+        Image::Buffer buffer = owned.detach();
+        assert(buffer.get() == pixels && owned.isEmpty() && !owned.ownsData());
+        assert(!freed);
+        buffer.reset();
+        assert(freed);
+
+        Image allocated(16, 16);
+        const unsigned char* allocatedData = allocated.data();
+        Image::Buffer allocatedBuffer = allocated.detach();
+        assert(allocatedBuffer.get() == allocatedData && allocated.isEmpty());
+
+        unsigned char borrowedPixels[16] = {};
+        Image borrowed(borrowedPixels, 4, 4, 4);
+        Image::Buffer borrowedBuffer = borrowed.detach();
+        assert(borrowedBuffer.get() == borrowedPixels);
+        borrowedBuffer.reset();
+        assert(!Image().detach());
+    }
+
+    // Mapped loads see the pixels of a regular load, and copy-on-write
+    // changes never reach the file
+    {
+        Image padded(img.width(), img.height(), 13, 2);
+        for (unsigned int y = 0; y < img.height(); y++) {
+            std::copy(img.row(y), img.row(y) + img.width(), padded.row(y));
+        }
+        bool saved_ok = padded.savePreallocated("mapped.pgm");
+        assert(saved_ok);
+
+        Image mapped;
+        bool mapped_ok = mapped.loadMapped("mapped.pgm");
+        assert(mapped_ok);
+        assert(samePixels(mapped, img));
+        assert(mapped.stride() == mapped.width());
+
+        Image writable;
+        writable.loadMapped("mapped.pgm", Image::MapMode::CopyOnWrite);
+        writable.row(0)[0] = static_cast<unsigned char>(~img.row(0)[0]);
+        Image reloaded;
+        reloaded.load("mapped.pgm");
+        assert(samePixels(reloaded, img));
+        assert(!samePixels(writable, img));
+
+#ifdef __linux__
+        // A file too large for the file size limit fails at allocation, like
+        // a full disk, and the partial file is removed
+        struct rlimit limit;
+        getrlimit(RLIMIT_FSIZE, &limit);
+        struct rlimit smallLimit = limit;
+        smallLimit.rlim_cur = 4096;
+        void (*previousHandler)(int) = signal(SIGXFSZ, SIG_IGN);
+        setrlimit(RLIMIT_FSIZE, &smallLimit);
+        bool tooLarge_ok = padded.savePreallocated("too_large.pgm");
+        setrlimit(RLIMIT_FSIZE, &limit);
+        signal(SIGXFSZ, previousHandler);
+        assert(!tooLarge_ok);
+        assert(!std::filesystem::exists("too_large.pgm"));
+#endif
+
+        Image fromMapped, fromLoaded;
+        sobel.process(mapped, fromMapped);
+        sobel.process(img, fromLoaded);
+        assert(samePixels(fromMapped, fromLoaded));
+    }
+
+    // Batch inputs whose names clash in the output directory stop the run
+    // before anything is written
+    {
+        namespace fs = std::filesystem;
+        fs::create_directories("batch_input/one");
+        fs::create_directories("batch_input/two");
+        img.save("batch_input/one/frame.pgm");
+        img.save("batch_input/two/frame.pgm");
+        fs::remove_all("batch_output");
+        BatchOptions options;
+        options.inputs = {"batch_input/one", "batch_input/two"};
+        options.outputDir = "batch_output";
+        bool rejected = false;
+        try {
+            runBatch(options);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        assert(rejected && !fs::exists("batch_output"));
+        options.inputs = {"batch_input/one"};
+        options.operations = "gausian:5:1.0";
+        rejected = false;
+        try {
+            runBatch(options);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        assert(rejected && !fs::exists("batch_output"));
+        options.operations.clear();
+        options.inputs = {"batch_input/one"};
+        assert(runBatch(options) == 0 && fs::exists("batch_output/frame.pgm"));
+
+        // A header claiming more pixels than the file holds, or a short
+        // payload, fails that file alone
+        {
+            std::ofstream huge("batch_input/one/huge.pgm", std::ios::binary);
+            huge << "P5\n60000 60000\n255\n";
+            std::ofstream truncated("batch_input/one/truncated.pgm", std::ios::binary);
+            truncated << "P5\n100 100\n255\n" << "ab";
+            std::ofstream badMax("batch_input/one/zzz.pgm", std::ios::binary);
+            badMax << "P5\n2 2\n0\n" << "abcd";
+        }
+        Image rejectedImage;
+        assert(!rejectedImage.load("batch_input/one/huge.pgm") && rejectedImage.isEmpty());
+        assert(!rejectedImage.load("batch_input/one/truncated.pgm") && rejectedImage.isEmpty());
+        assert(!rejectedImage.load("batch_input/one/zzz.pgm") && rejectedImage.isEmpty());
+        fs::remove_all("batch_output");
+        options.operations = "gaussian:5:1.0";
+        assert(runBatch(options) == 3);
+        assert(fs::exists("batch_output/frame.pgm") && !fs::exists("batch_output/huge.pgm") &&
+               !fs::exists("batch_output/truncated.pgm") && !fs::exists("batch_output/zzz.pgm"));
+        fs::remove_all("batch_input");
+        fs::remove_all("batch_output");
+    }
+
+    // Streaming strips with just enough overlap for the halo gives the
+    // same file as processing the whole image, also for strips of a few rows
+    {
+        Pipeline chain{&gaussianBlur, &sobel, &meanBlur, &sharpen, &bc};
+        for (ImageProcessing* processor : std::vector<ImageProcessing*>{&sobel, &gc, &meanBlur, &gaussianBlur, &sharpen, &chain}) {
+            Image full;
+            processor->process(img, full);
+            for (unsigned int stripHeight : {1u, 7u, img.height()}) {
+                PgmStripReader reader(stripHeight, processor->halo());
+                PgmStripWriter writer;
+                bool opened = reader.open(argv[1]) && writer.open("streamed.pgm", reader.width(), reader.height());
+                assert(opened);
+                bool streamed_ok = processStrips(*processor, reader, writer);
+                assert(streamed_ok);
+                Image streamed;
+                streamed.load("streamed.pgm");
+                assert(samePixels(streamed, full));
+            }
+        }
+    }
+
+    // A stream of frames, one of another size in the middle, comes out
+    // processed frame by frame; past the first frames of each ring slot a
+    // longer stream allocates no more than a short one
+    {
+        Image small;
+        img.getROI(small, Rectangle(0, 0, img.width() / 2, img.height() / 3));
+        auto writeFrames = [&](const char* path, unsigned int count) {
+            std::FILE* file = std::fopen(path, "wb");
+            FrameWriter frames(fileno(file));
+            for (unsigned int i = 0; i < count; i++) {
+                frames.writeFrame(i == 5 ? small : img);
+            }
+            std::fclose(file);
+        };
+        auto streamFrames = [&](ImageProcessing& processor, const char* from, const char* to) {
+            std::FILE* in = std::fopen(from, "rb");
+            std::FILE* out = std::fopen(to, "wb");
+            StreamStats stats = runStream(processor, fileno(in), fileno(out));
+            std::fclose(in);
+            std::fclose(out);
+            return stats;
+        };
+
+        Pipeline chain{&gaussianBlur, &sobel};
+        writeFrames("frames.pgm", 12);
+        StreamStats stats = streamFrames(chain, "frames.pgm", "frames_out.pgm");
+        assert(!stats.failed && stats.frames == 12 && stats.latency.count() == 12);
+        assert(stats.latency.percentile(0.5) <= stats.latency.percentile(0.99));
+
+        std::FILE* file = std::fopen("frames_out.pgm", "rb");
+        FrameReader frames(fileno(file));
+        Image streamed, expected;
+        for (unsigned int i = 0; i < 12; i++) {
+            bool read_ok = frames.readFrame(streamed);
+            assert(read_ok);
+            chain.process(i == 5 ? small : img, expected);
+            assert(samePixels(streamed, expected));
+        }
+        assert(!frames.readFrame(streamed) && !frames.failed());
+        std::fclose(file);
+
+        writeFrames("frames.pgm", 4);
+        streamFrames(chain, "frames.pgm", "frames_out.pgm");
+        size_t shortStream = g_allocations;
+        streamFrames(chain, "frames.pgm", "frames_out.pgm");
+        shortStream = g_allocations - shortStream;
+        // Same size all along
+        small = img;
+        writeFrames("frames.pgm", 40);
+        size_t longStream = g_allocations;
+        streamFrames(chain, "frames.pgm", "frames_out.pgm");
+        longStream = g_allocations - longStream;
+        assert(longStream == shortStream);
+
+        // A processor that throws, or a header past the size cap, fails the
+        // run instead of ending the program; frames done before are written
+        struct ThrowingProcessor : ImageProcessing {
+            unsigned int calls = 0;
+
+        protected:
+            bool doProcess(ConstImageView input, ImageView output) override {
+                if (++calls == 3)
+                    throw std::runtime_error("frame failed");
+                copyPixels(input, output);
+                return true;
+            }
+        } throwing;
+        writeFrames("frames.pgm", 6);
+        stats = streamFrames(throwing, "frames.pgm", "frames_out.pgm");
+        assert(stats.failed && stats.frames == 2);
+
+        std::FILE* oversized = std::fopen("frames.pgm", "wb");
+        std::fputs("P5\n60000 60000\n255\n", oversized);
+        std::fclose(oversized);
+        stats = streamFrames(chain, "frames.pgm", "frames_out.pgm");
+        assert(stats.failed && stats.frames == 0);
+    }
+
+#ifdef IMAGE_INSTRUMENTATION
+    // Every call is counted under its class, the stages of a Pipeline
+    // inside the Pipeline call, and the trace has a lane per thread
+    {
+        Pipeline chain{&gaussianBlur, &sobel};
+        Image output;
+        Instrumentation::reset();
+        Instrumentation::startTrace();
+        chain.process(img, output);
+        chain.process(img, output);
+        Instrumentation::stopTrace();
+
+        Instrumentation::CallStats whole = Instrumentation::stats("Pipeline");
+        Instrumentation::CallStats stage = Instrumentation::stats("GaussianBlur");
+        assert(whole.calls == 2);
+        assert(whole.pixels == 2ull * img.width() * img.height());
+        assert(stage.calls >= 2 && stage.pixels >= whole.pixels);
+        assert(whole.totalMs >= whole.maxMs && whole.maxMs > 0.0);
+        assert(Instrumentation::stats("MeanBlur").calls == 0);
+
+        // The gradient overload of SobelFilter is counted like process()
+        SobelFilter::Gradients gradients;
+        const uint64_t sobelCalls = Instrumentation::stats("SobelFilter").calls;
+        sobel.process(img, output, gradients);
+        assert(Instrumentation::stats("SobelFilter").calls == sobelCalls + 1);
+        assert(Instrumentation::peakImageBytes() >= Instrumentation::liveImageBytes());
+        assert(Instrumentation::liveImageBytes() >= static_cast<uint64_t>(output.stride()) * output.height());
+
+        for (const auto& entry : Instrumentation::stats()) {
+            std::cout << entry.first << ": " << entry.second.calls << " calls, " << entry.second.totalMs << " ms"
+                      << std::endl;
+        }
+        bool trace_ok = Instrumentation::writeTrace("trace.json");
+        assert(trace_ok);
+    }
+
+    // The scratch buffer of a large region is given back once a much
+    // smaller region is processed on the same thread
+    {
+        Image large(1024, 1024), output(1024, 1024);
+        MeanBlur blur(5);
+        blur.process(large, output, Rectangle(1, 1, 1022, 1022));
+        const uint64_t afterLarge = Instrumentation::liveImageBytes();
+        blur.process(large, output, Rectangle(10, 10, 8, 8));
+        assert(Instrumentation::liveImageBytes() + 1000000 < afterLarge);
+    }
+#endif
+
     // Draw some shapes
     Image drawing = Image::zeros(img.width(), img.height());
     Drawing::drawCircle(drawing, Point(img.width()/2, img.height()/2), 50, 255);